@@ -23,6 +23,7 @@ USA.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include <prolog/relation.h>
@@ -69,6 +70,10 @@ USA.
             __s = ((s) ? strdup(s) : strdup(""));       \
             __s; })
 
+#define NHANDLER (int)(sizeof(((factmap_t *)0)->handlers) / sizeof(gulong))
+
+#define VIEW_CHANGES(v) (OHM_FACT_STORE_SIMPLE_VIEW(v)->change_set)
+
 #define DEBUG(fmt, args...) do {                                \
         int __depth = depth;                                    \
         while (__depth-- > 0)                                   \
@@ -77,16 +82,362 @@ USA.
     } while (0)
 
 
+static gboolean factmap_idle(gpointer data);
+
+
+/*
+ * Notes:
+ *   To keep updates proportional to the number of changed facts we remember
+ *   the row each fact was last mapped to. Distinct facts can map to the same
+ *   row, so rows are shared and counted, and a tuple is deleted from the
+ *   relation only when the last fact mapping to it goes away.
+ */
+
+typedef struct {
+    char **items;                            /* interned, NULL-terminated */
+    int    nfact;                            /* number of facts mapped here */
+} row_t;
+
+
+/********************
+ * items_hash
+ ********************/
+static guint
+items_hash(gconstpointer key)
+{
+    char * const *items = key;
+    guint         h     = 0;
+
+    while (*items != NULL)
+        h = 31 * h + (guint)((unsigned long)*items++ >> 3);
+
+    return h;
+}
+
+
+/********************
+ * items_equal
+ ********************/
+static gboolean
+items_equal(gconstpointer a, gconstpointer b)
+{
+    char * const *ia = a, * const *ib = b;
+
+    /* items are interned, so comparing the pointers is enough */
+    while (*ia != NULL && *ia == *ib) {
+        ia++;
+        ib++;
+    }
+
+    return *ia == *ib;
+}
+
+
+/********************
+ * items_free
+ ********************/
+static void
+items_free(char **items)
+{
+    char **p;
+
+    if (items == NULL)
+        return;
+
+    for (p = items; *p != NULL; p++)
+        item_unref(*p);
+    FREE(items);
+}
+
+
+/********************
+ * row_destroy
+ ********************/
+static void
+row_destroy(gpointer data)
+{
+    row_t *row = data;
+
+    items_free(row->items);
+    FREE(row);
+}
+
+
+/********************
+ * value_item
+ ********************/
+static item_t
+value_item(GValue *value)
+{
+    GValue  gstr = {0};
+    item_t  item;
+
+    /*
+     * Numbers are interned directly from their values, everything else
+     * by its string form.
+     */
+
+    switch (G_VALUE_TYPE(value)) {
+    case G_TYPE_INT:     return item_intern_int(g_value_get_int(value));
+    case G_TYPE_UINT:    return item_intern_int(g_value_get_uint(value));
+    case G_TYPE_LONG:    return item_intern_int(g_value_get_long(value));
+    case G_TYPE_ULONG:   return item_intern_int(g_value_get_ulong(value));
+    case G_TYPE_INT64:   return item_intern_int(g_value_get_int64(value));
+    case G_TYPE_UINT64:  return item_intern_int(g_value_get_uint64(value));
+    case G_TYPE_BOOLEAN: return item_intern_int(g_value_get_boolean(value));
+    case G_TYPE_CHAR:    return item_intern_int(g_value_get_char(value));
+    case G_TYPE_UCHAR:   return item_intern_int(g_value_get_uchar(value));
+    case G_TYPE_FLOAT:   return item_intern_double(g_value_get_float(value));
+    case G_TYPE_DOUBLE:  return item_intern_double(g_value_get_double(value));
+
+    case G_TYPE_STRING:
+        if (g_value_get_string(value) == NULL)
+            return NULL;
+        return item_intern(g_value_get_string(value));
+
+    default:
+        if (!g_value_type_transformable(G_VALUE_TYPE(value), G_TYPE_STRING))
+            return NULL;
+
+        item = NULL;
+        g_value_init(&gstr, G_TYPE_STRING);
+        if (g_value_transform(value, &gstr) &&
+            g_value_get_string(&gstr) != NULL)
+            item = item_intern(g_value_get_string(&gstr));
+        g_value_unset(&gstr);
+
+        return item;
+    }
+}
+
+
+/********************
+ * fact_items
+ ********************/
+static int
+fact_items(factmap_t *map, OhmFact *fact, char ***itemsp)
+{
+    item_type_t  *types = map->relation->types;
+    GValue       *value;
+    char        **items;
+    int           i, status;
+
+    /*
+     * Convert the members of fact to a row of interned items. *itemsp is
+     * set to NULL if the filter rejects the row, or if a member does not
+     * fit the type of its column. Such a fact is simply left out of the
+     * relation, like a filtered one, instead of failing the whole map.
+     */
+
+    *itemsp = NULL;
+
+    if ((items = ALLOC_ARR(char *, map->nmember + 1)) == NULL)
+        return ENOMEM;
+
+    status = EIO;
+    for (i = 0; i < map->nmember; i++) {
+        if ((value = ohm_fact_get(fact, map->members[i])) == NULL ||
+            (items[i] = value_item(value)) == NULL)
+            goto fail;
+
+        if (types == NULL || types[i] == ITEM_STRING)
+            continue;
+
+        if (item_type(items[i]) == ITEM_STRING ||
+            (types[i] == ITEM_INT && item_type(items[i]) != ITEM_INT)) {
+            if (!map->mistyped) {
+                g_warning("factmap %s: skipping %s facts with mistyped %s",
+                          map->relation->name, map->key, map->members[i]);
+                map->mistyped = TRUE;
+            }
+            status = 0;
+            goto fail;
+        }
+    }
+
+    if (map->filter == NULL ||
+        map->filter(map->nmember, items, map->filter_data))
+        *itemsp = items;
+    else
+        items_free(items);
+
+    return 0;
+
+ fail:
+    items_free(items);
+    return status;
+}
+
+
+/********************
+ * fact_track
+ ********************/
+static row_t *
+fact_track(factmap_t *map, OhmFact *fact, char **items)
+{
+    row_t *row;
+
+    if ((row = g_hash_table_lookup(map->rows, items)) != NULL)
+        items_free(items);
+    else {
+        if ((row = ALLOC(row_t)) == NULL) {
+            items_free(items);
+            return NULL;
+        }
+        row->items = items;
+        g_hash_table_insert(map->rows, row->items, row);
+    }
+
+    row->nfact++;
+    g_hash_table_insert(map->facts, g_object_ref(fact), row);
+
+    return row;
+}
+
+
+/********************
+ * fact_forget
+ ********************/
+static int
+fact_forget(factmap_t *map, OhmFact *fact)
+{
+    row_t *row;
+    int    status;
+
+    if ((row = g_hash_table_lookup(map->facts, fact)) == NULL)
+        return 0;
+
+    status = 0;
+    if (--row->nfact == 0) {
+        status = relation_delete(map->relation, row->items);
+        g_hash_table_remove(map->rows, row->items);
+    }
+    g_hash_table_remove(map->facts, fact);
+
+    return status;
+}
+
+
+/********************
+ * fact_refresh
+ ********************/
+static int
+fact_refresh(factmap_t *map, OhmFact *fact)
+{
+    row_t  *row;
+    char  **items;
+    int     status;
+
+    /*
+     * Drop the row the fact was mapped to and, unless the fact has been
+     * removed from the store since, map it again. Looking at the current
+     * state of the fact makes this independent of the order and number
+     * of the changes recorded for it.
+     */
+
+    if ((status = fact_forget(map, fact)) != 0)
+        return status;
+
+    if (ohm_fact_get_fact_store(fact) != map->store)
+        return 0;
+
+    if ((status = fact_items(map, fact, &items)) != 0 || items == NULL)
+        return status;
+
+    if ((row = fact_track(map, fact, items)) == NULL)
+        return ENOMEM;
+
+    if (row->nfact == 1)
+        return relation_insert(map->relation, row->items);
+    else
+        return 0;
+}
+
+
+/********************
+ * factmap_load
+ ********************/
+static int
+factmap_load(factmap_t *map)
+{
+    OhmFact        *fact;
+    GSList         *l, *facts;
+    GHashTableIter  it;
+    gpointer        key;
+    char         ***rows, **items;
+    int             nrow, status;
+
+    /*
+     * (re)load the relation with all facts; collect all the rows first,
+     * then load them into the relation in one go
+     */
+
+    g_hash_table_remove_all(map->facts);
+    g_hash_table_remove_all(map->rows);
+    relation_reset(map->relation);
+
+    facts = ohm_fact_store_get_facts_by_name(map->store, map->key);
+    for (l = facts; l != NULL; l = g_slist_next(l)) {
+        fact = OHM_FACT(l->data);
+
+        if ((status = fact_items(map, fact, &items)) != 0)
+            goto fail;
+        if (items != NULL && fact_track(map, fact, items) == NULL) {
+            status = ENOMEM;
+            goto fail;
+        }
+    }
+
+    if ((rows = ALLOC_ARR(char **, g_hash_table_size(map->rows) + 1)) == NULL) {
+        status = ENOMEM;
+        goto fail;
+    }
+
+    nrow = 0;
+    g_hash_table_iter_init(&it, map->rows);
+    while (g_hash_table_iter_next(&it, &key, NULL))
+        rows[nrow++] = key;
+    rows[nrow] = NULL;
+
+    status = relation_insert_many(map->relation, rows);
+    FREE(rows);
+
+    if (status != 0)
+        goto fail;
+
+    ohm_fact_store_change_set_reset(VIEW_CHANGES(map->view));
+    return 0;
+
+ fail:
+    g_hash_table_remove_all(map->facts);
+    g_hash_table_remove_all(map->rows);
+    relation_reset(map->relation);
+    return status;
+}
+
+
 /********************
  * factmap_create
  ********************/
 factmap_t *
 factmap_create(OhmFactStore *store, char *name, char *key, char **members,
                int (*filter)(int, char **, void *), void *filter_data)
+{
+    return factmap_create_typed(store, name, key, members, NULL,
+                                filter, filter_data);
+}
+
+
+/********************
+ * factmap_create_typed
+ ********************/
+factmap_t *
+factmap_create_typed(OhmFactStore *store, char *name, char *key,
+                     char **members, item_type_t *types,
+                     int (*filter)(int, char **, void *), void *filter_data)
 {
     factmap_t *map;
     int        i, arity;
-    char      *p;
 
     if (store == NULL || name == NULL || key == NULL || members == NULL)
         return NULL;
@@ -108,11 +459,19 @@ factmap_create(OhmFactStore *store, char *name, char *key, char **members,
     if ((map->members = ALLOC_ARR(char *, arity)) == NULL ||
         (map->relation = relation_create(name, arity, NULL)) == NULL)
         goto fail;
+
+    if (types != NULL && relation_set_types(map->relation, types) != 0)
+        goto fail;
     
     for (i = 0; i < arity; i++)
-        if ((map->members[i] = STRDUP(members[i])) == NULL)
+        if ((map->members[i] = item_intern(members[i])) == NULL)
             goto fail;
 
+    map->facts = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                       g_object_unref, NULL);
+    map->rows  = g_hash_table_new_full(items_hash, items_equal,
+                                       NULL, row_destroy);
+
     if (factmap_update(map) != 0)
         goto fail;
     
@@ -120,6 +479,7 @@ factmap_create(OhmFactStore *store, char *name, char *key, char **members,
     
  fail:
     factmap_destroy(map);
+    return NULL;
 }
 
 
@@ -133,6 +493,8 @@ factmap_destroy(factmap_t *map)
     
     if (map == NULL)
         return;
+
+    factmap_set_refresh(map, FACTMAP_MANUAL);
     
     if (map->key)
         FREE(map->key);
@@ -140,15 +502,20 @@ factmap_destroy(factmap_t *map)
     if (map->members) {
         for (i = map->nmember - 1; i >= 0; i--)
             if (map->members[i] != NULL)
-                FREE(map->members[i]);
+                item_unref(map->members[i]);
         FREE(map->members);
     }
 
     if (map->view) {
-        ohm_view_reset_changes(map->view);
+        ohm_fact_store_change_set_reset(VIEW_CHANGES(map->view));
         g_object_unref(map->view);
     }
 
+    if (map->facts)
+        g_hash_table_destroy(map->facts);
+    if (map->rows)
+        g_hash_table_destroy(map->rows);
+
     relation_destroy(map->relation);
     FREE(map);
 }
@@ -160,78 +527,178 @@ factmap_destroy(factmap_t *map)
 int
 factmap_update(factmap_t *map)
 {
-    OhmFact    *fact;
-    OhmPattern *pattern;
-    
-    GSList  *l, *updates;
-    GValue  *value, gstr = {0};
-    char    *row[map->nmember];
-    int      i;
-    char     buf[map->nmember * 32], *p;
-    size_t   left, n;
-    
+    OhmFactStoreChange *c;
+    int                 status;
 
     /*
-     * if we have a pattern check its view for updates
+     * The first update loads every fact. After that only the facts in
+     * the change set of our view are remapped.
      */
 
-    if (map->view != NULL) {
-        if ((updates = ohm_view_get_changes(map->view)) == NULL) {
-            printf("***** no updates\n");
-            return 0;
-        }
-    }
-    else {
+    map->dirty = FALSE;
+
+    if (map->view == NULL) {
         if ((map->view = ohm_fact_store_new_view(map->store, NULL)) == NULL)
             return EIO;
         if (!ohm_view_add_pattern(map->view, map->key))
             return EIO;
+        
+        return factmap_load(map);
     }
 
-    printf("***** has updates\n");
-    
-    relation_reset(map->relation);
-    
-    p    = buf;
-    left = sizeof(buf) - 1;
-    for (l = ohm_fact_store_get_facts_by_name(map->store, map->key);
-         l != NULL;
-         l = g_slist_next(l)) {
-        fact = OHM_FACT(l->data);
-        for (i = 0; i < map->nmember; i++) {
-            if ((value = ohm_fact_get(fact, map->members[i])) == NULL)
-                return EIO;
+    status = 0;
+    c      = ohm_fact_store_change_set_get_changes(VIEW_CHANGES(map->view));
+    for ( ; c != NULL && status == 0; c = c->next) {
+        if (c->event == OHM_FACT_STORE_EVENT_LOOKUP)
+            continue;
 
-            if (G_VALUE_HOLDS_STRING(value)) {
-                row[i] = (char *)g_value_get_string(value);
-                continue;
-            }
-            
-            if (!g_value_type_transformable(G_VALUE_TYPE(value), G_TYPE_STRING))
-                return EIO;
-            
-            g_value_init(&gstr, G_TYPE_STRING);
-            if (!g_value_transform(value, &gstr))
-                return EIO;
-            
-            n = snprintf(p, left, "%s", g_value_get_string(&gstr));
-            g_value_unset(&gstr);
-            
-            if (n >= left)
-                return EIO;
-            
-            row[i]  = p;
-            p      += n;
+        status = fact_refresh(map, c->fact);
+    }
+
+    if (status != 0)                      /* out of sync, start over */
+        return factmap_load(map);
+
+    ohm_fact_store_change_set_reset(VIEW_CHANGES(map->view));
+    return 0;
+}
+
+
+/********************
+ * factmap_mark
+ ********************/
+static void
+factmap_mark(factmap_t *map)
+{
+    if (map->dirty)
+        return;
+
+    map->dirty = TRUE;
+
+    switch (map->mode) {
+    case FACTMAP_LAZY:
+        relation_invalidate(map->relation);
+        break;
+    case FACTMAP_IDLE:
+        if (map->idle == 0)
+            map->idle = g_idle_add(factmap_idle, map);
+        break;
+    default:
+        break;
+    }
+}
+
+
+/********************
+ * fact_changed
+ ********************/
+static void
+fact_changed(OhmFactStore *store, OhmFact *fact, gpointer data)
+{
+    factmap_t *map = (factmap_t *)data;
+
+    (void)store;
+
+    if (ohm_structure_get_qname(OHM_STRUCTURE(fact)) == map->qkey)
+        factmap_mark(map);
+}
+
+
+/********************
+ * fact_updated
+ ********************/
+static void
+fact_updated(OhmFactStore *store, OhmFact *fact, guint field, gpointer value,
+             gpointer data)
+{
+    (void)field;
+    (void)value;
+
+    fact_changed(store, fact, data);
+}
+
+
+/********************
+ * factmap_idle
+ ********************/
+static gboolean
+factmap_idle(gpointer data)
+{
+    factmap_t *map = (factmap_t *)data;
+
+    map->idle = 0;
+    factmap_update(map);
+
+    return FALSE;
+}
+
+
+/********************
+ * factmap_refresh
+ ********************/
+static int
+factmap_refresh(relation_t *r, void *data)
+{
+    (void)r;
+
+    return factmap_update((factmap_t *)data);
+}
+
+
+/********************
+ * factmap_set_refresh
+ ********************/
+int
+factmap_set_refresh(factmap_t *map, factmap_refresh_t mode)
+{
+    int i;
+
+    /*
+     * In the automatic modes we listen to the signals of the store and
+     * only mark the map dirty when a fact of ours changes. The change set
+     * of our view is then applied from an idle callback or, lazily, by
+     * the first reader of the relation.
+     */
+
+    if (mode != FACTMAP_MANUAL && mode != FACTMAP_LAZY && mode != FACTMAP_IDLE)
+        return EINVAL;
+
+    if (mode == map->mode)
+        return 0;
+
+    for (i = 0; i < NHANDLER; i++) {
+        if (map->handlers[i] != 0) {
+            g_signal_handler_disconnect(map->store, map->handlers[i]);
+            map->handlers[i] = 0;
         }
-        if (map->filter == NULL ||
-            map->filter(map->nmember, row, map->filter_data))
-            if (relation_insert(map->relation, row))
-                return EIO;
     }
-    
-    if (map->view)
-        ohm_view_reset_changes(map->view);
-    
+    if (map->idle != 0) {
+        g_source_remove(map->idle);
+        map->idle = 0;
+    }
+    if (map->relation != NULL)
+        relation_set_refresh(map->relation, NULL, NULL);
+
+    map->mode = mode;
+
+    if (mode == FACTMAP_MANUAL)
+        return 0;
+
+    if (mode == FACTMAP_LAZY)
+        relation_set_refresh(map->relation, factmap_refresh, map);
+
+    map->qkey        = g_quark_from_string(map->key);
+    map->handlers[0] = g_signal_connect(map->store, "inserted",
+                                        G_CALLBACK(fact_changed), map);
+    map->handlers[1] = g_signal_connect(map->store, "removed",
+                                        G_CALLBACK(fact_changed), map);
+    map->handlers[2] = g_signal_connect(map->store, "updated",
+                                        G_CALLBACK(fact_updated), map);
+
+    /* pick up whatever has changed since the last update */
+    map->dirty = FALSE;
+    if (ohm_fact_store_change_set_get_changes(VIEW_CHANGES(map->view)))
+        factmap_mark(map);
+
     return 0;
 }
 
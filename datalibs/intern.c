@@ -0,0 +1,551 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+
+#include <prolog/intern.h>
+
+
+#define HASH_MIN 64
+#define NUMBER_LEN 32                           /* enough for any number */
+
+typedef struct {
+    int           refcnt;                       /* references to item */
+    unsigned int  hash;                         /* hash of name */
+    int           index;                        /* dense item index */
+    item_type_t   type;                         /* numeric type, if any */
+    union {
+        long      i;                            /* ITEM_INT value */
+        double    d;                            /* ITEM_DOUBLE value */
+    } value;
+    char          name[];                       /* interned string */
+} entry_t;
+
+#define ENTRY(item) ((entry_t *)((item) - offsetof(entry_t, name)))
+
+
+/*
+ * Notes:
+ *     Entries are hashed using open addressing with linear probing and
+ *     backward shift deletion, just like the relation tuples. The table
+ *     is kept a power of two in size and at most half full.
+ */
+
+static entry_t **table;                         /* interned entries */
+static int       ntable;                        /* size of table */
+static int       nentry;                        /* number of entries */
+
+static entry_t **entries;                       /* entries by index */
+static int       nindex;                        /* indices handed out */
+static int       nentries;                      /* size of entries */
+static int      *freeidx;                       /* released indices */
+static int       nfreeidx;                      /* number of free indices */
+
+
+/********************
+ * index_alloc
+ ********************/
+static int
+index_alloc(entry_t *e)
+{
+    entry_t **p;
+    int      *f, size;
+
+    /*
+     * Released indices are reused first to keep the indices dense, which
+     * keeps bitmaps over them (see set.c) small.
+     */
+
+    if (nfreeidx > 0) {
+        e->index = freeidx[--nfreeidx];
+        entries[e->index] = e;
+        return 0;
+    }
+
+    if (nindex >= nentries) {
+        size = nentries ? 2 * nentries : HASH_MIN;
+        if ((p = realloc(entries, size * sizeof(*p))) == NULL)
+            return ENOMEM;
+        entries = p;
+        /* make sure releasing an index never needs to allocate */
+        if ((f = realloc(freeidx, size * sizeof(*f))) == NULL)
+            return ENOMEM;
+        freeidx  = f;
+        nentries = size;
+    }
+
+    e->index = nindex++;
+    entries[e->index] = e;
+
+    return 0;
+}
+
+
+/********************
+ * index_free
+ ********************/
+static void
+index_free(entry_t *e)
+{
+    entries[e->index]   = NULL;
+    freeidx[nfreeidx++] = e->index;
+
+    if (nentry == 0) {
+        free(entries);
+        free(freeidx);
+        entries  = NULL;
+        freeidx  = NULL;
+        nentries = nindex = nfreeidx = 0;
+    }
+}
+
+
+/********************
+ * name_hash
+ ********************/
+static unsigned int
+name_hash(const char *name)
+{
+    unsigned int h = 2166136261U;                           /* FNV-1a */
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619U;
+
+    return h;
+}
+
+
+/********************
+ * intern_rehash
+ ********************/
+static int
+intern_rehash(int size)
+{
+    entry_t      **hash;
+    unsigned int   mask = size - 1, b;
+    int            i;
+
+    if ((hash = calloc(size, sizeof(*hash))) == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < ntable; i++) {
+        if (table[i] == NULL)
+            continue;
+        for (b = table[i]->hash & mask; hash[b]; b = (b + 1) & mask)
+            ;
+        hash[b] = table[i];
+    }
+
+    free(table);
+    table  = hash;
+    ntable = size;
+
+    return 0;
+}
+
+
+/********************
+ * intern_find
+ ********************/
+static int
+intern_find(const char *name, unsigned int hash)
+{
+    unsigned int mask, b;
+
+    if (table == NULL)
+        return -1;
+
+    mask = ntable - 1;
+    for (b = hash & mask; table[b]; b = (b + 1) & mask)
+        if (table[b]->hash == hash && !strcmp(table[b]->name, name))
+            return b;
+
+    return -1;
+}
+
+
+/********************
+ * format_int
+ ********************/
+static void
+format_int(char *buf, long value)
+{
+    snprintf(buf, NUMBER_LEN, "%ld", value);
+}
+
+
+/********************
+ * format_double
+ ********************/
+static void
+format_double(char *buf, double value)
+{
+    /*
+     * Integral values are formatted as integers, so the same number has
+     * the same item whether it was given as an integer or not. Others get
+     * the shortest of the two usual precisions that still round-trips.
+     */
+
+    if (fabs(value) < 9007199254740992.0 && fabs(value) < (double)LONG_MAX &&
+        value == (double)(long)value)
+        format_int(buf, (long)value);
+    else {
+        snprintf(buf, NUMBER_LEN, "%.15g", value);
+        if (strtod(buf, NULL) != value)
+            snprintf(buf, NUMBER_LEN, "%.17g", value);
+    }
+}
+
+
+/********************
+ * name_parse
+ ********************/
+static item_type_t
+name_parse(const char *name, long *ip, double *dp)
+{
+    char   buf[NUMBER_LEN], *end;
+    long   i;
+    double d;
+
+    /*
+     * Only names in canonical form are numbers, otherwise the same number
+     * could end up as several different items.
+     */
+
+    if (!isdigit((unsigned char)name[0]) && name[0] != '-')
+        return ITEM_STRING;
+
+    errno = 0;
+    i = strtol(name, &end, 10);
+    if (*end == '\0' && errno == 0) {
+        format_int(buf, i);
+        if (strcmp(buf, name))
+            return ITEM_STRING;
+        *ip = i;
+        return ITEM_INT;
+    }
+
+    d = strtod(name, &end);
+    if (*end == '\0' && isfinite(d)) {
+        format_double(buf, d);
+        if (strcmp(buf, name))
+            return ITEM_STRING;
+        *dp = d;
+        return ITEM_DOUBLE;
+    }
+
+    return ITEM_STRING;
+}
+
+
+/********************
+ * entry_parse
+ ********************/
+static void
+entry_parse(entry_t *e)
+{
+    long   i;
+    double d;
+
+    switch ((e->type = name_parse(e->name, &i, &d))) {
+    case ITEM_INT:    e->value.i = i; break;
+    case ITEM_DOUBLE: e->value.d = d; break;
+    default:                          break;
+    }
+}
+
+
+/********************
+ * item_intern
+ ********************/
+item_t
+item_intern(const char *name)
+{
+    entry_t      *e;
+    unsigned int  hash, mask, b;
+    int           i;
+    size_t        len;
+
+    hash = name_hash(name);
+
+    if ((i = intern_find(name, hash)) >= 0) {
+        table[i]->refcnt++;
+        return table[i]->name;
+    }
+
+    if (2 * (nentry + 1) > ntable)
+        if (intern_rehash(ntable ? 2 * ntable : HASH_MIN))
+            return NULL;
+
+    len = strlen(name);
+    if ((e = malloc(sizeof(*e) + len + 1)) == NULL)
+        return NULL;
+
+    e->refcnt = 1;
+    e->hash   = hash;
+    memcpy(e->name, name, len + 1);
+    entry_parse(e);
+
+    if (index_alloc(e) != 0) {
+        free(e);
+        return NULL;
+    }
+
+    mask = ntable - 1;
+    for (b = hash & mask; table[b]; b = (b + 1) & mask)
+        ;
+    table[b] = e;
+    nentry++;
+
+    return e->name;
+}
+
+
+/********************
+ * item_find
+ ********************/
+item_t
+item_find(const char *name)
+{
+    int i;
+
+    if ((i = intern_find(name, name_hash(name))) < 0)
+        return NULL;
+    else
+        return table[i]->name;
+}
+
+
+/********************
+ * item_ref
+ ********************/
+item_t
+item_ref(item_t item)
+{
+    if (item != NULL)
+        ENTRY(item)->refcnt++;
+
+    return item;
+}
+
+
+/********************
+ * item_unref
+ ********************/
+void
+item_unref(item_t item)
+{
+    entry_t      *e;
+    unsigned int  mask, b, n, home;
+
+    if (item == NULL)
+        return;
+
+    e = ENTRY(item);
+    if (--e->refcnt > 0)
+        return;
+
+    mask = ntable - 1;
+    for (b = e->hash & mask; table[b] != e; b = (b + 1) & mask)
+        if (table[b] == NULL)
+            goto out;                               /* should not happen */
+
+    /* shift back any entries that would become unreachable */
+    for (n = (b + 1) & mask; table[n]; n = (n + 1) & mask) {
+        home = table[n]->hash & mask;
+        if (((n - home) & mask) >= ((n - b) & mask)) {
+            table[b] = table[n];
+            b = n;
+        }
+    }
+    table[b] = NULL;
+    nentry--;
+
+ out:
+    index_free(e);
+    free(e);
+
+    if (nentry == 0) {
+        free(table);
+        table  = NULL;
+        ntable = 0;
+    }
+}
+
+
+/********************
+ * item_index
+ ********************/
+int
+item_index(item_t item)
+{
+    return ENTRY(item)->index;
+}
+
+
+/********************
+ * item_at
+ ********************/
+item_t
+item_at(int index)
+{
+    if (index < 0 || index >= nindex || entries[index] == NULL)
+        return NULL;
+    else
+        return entries[index]->name;
+}
+
+
+/********************
+ * item_intern_int
+ ********************/
+item_t
+item_intern_int(long value)
+{
+    char buf[NUMBER_LEN];
+
+    format_int(buf, value);
+    return item_intern(buf);
+}
+
+
+/********************
+ * item_intern_double
+ ********************/
+item_t
+item_intern_double(double value)
+{
+    char buf[NUMBER_LEN];
+
+    if (!isfinite(value))
+        return NULL;
+
+    format_double(buf, value);
+    return item_intern(buf);
+}
+
+
+/********************
+ * item_find_int
+ ********************/
+item_t
+item_find_int(long value)
+{
+    char buf[NUMBER_LEN];
+
+    format_int(buf, value);
+    return item_find(buf);
+}
+
+
+/********************
+ * item_find_double
+ ********************/
+item_t
+item_find_double(double value)
+{
+    char buf[NUMBER_LEN];
+
+    if (!isfinite(value))
+        return NULL;
+
+    format_double(buf, value);
+    return item_find(buf);
+}
+
+
+/********************
+ * item_type
+ ********************/
+item_type_t
+item_type(item_t item)
+{
+    return ENTRY(item)->type;
+}
+
+
+/********************
+ * item_name_type
+ ********************/
+item_type_t
+item_name_type(const char *name)
+{
+    item_t item;
+    long   i;
+    double d;
+
+    /* the type name would be interned with, without interning it */
+    if ((item = item_find(name)) != NULL)
+        return item_type(item);
+    else
+        return name_parse(name, &i, &d);
+}
+
+
+/********************
+ * item_int
+ ********************/
+long
+item_int(item_t item)
+{
+    entry_t *e = ENTRY(item);
+
+    switch (e->type) {
+    case ITEM_INT:    return e->value.i;
+    case ITEM_DOUBLE: return (long)e->value.d;
+    default:          return 0;
+    }
+}
+
+
+/********************
+ * item_double
+ ********************/
+double
+item_double(item_t item)
+{
+    entry_t *e = ENTRY(item);
+
+    switch (e->type) {
+    case ITEM_INT:    return (double)e->value.i;
+    case ITEM_DOUBLE: return e->value.d;
+    default:          return 0.0;
+    }
+}
+
+
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+*/
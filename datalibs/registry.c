@@ -0,0 +1,254 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <prolog/registry.h>
+
+
+#define HASH_MIN    16
+#define SLOT_BITS   16
+#define SLOT_MASK   ((1 << SLOT_BITS) - 1)
+#define GEN_MASK    0x7fff
+
+#define NAME(reg, obj)   (*(char **)(((char *)(obj)) + (reg)->name_offs))
+#define HANDLE(reg, obj) (*(int *)(((char *)(obj)) + (reg)->handle_offs))
+
+
+/********************
+ * name_hash
+ ********************/
+static unsigned int
+name_hash(const char *name)
+{
+    unsigned int h = 2166136261U;                           /* FNV-1a */
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619U;
+
+    return h;
+}
+
+
+/********************
+ * registry_rehash
+ ********************/
+static int
+registry_rehash(registry_t *reg, int size)
+{
+    void         **hash;
+    unsigned int   mask = size - 1, b;
+    int            i;
+
+    if ((hash = calloc(size, sizeof(*hash))) == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < reg->nslot; i++) {
+        if (reg->objects[i] == NULL)
+            continue;
+        b = name_hash(NAME(reg, reg->objects[i])) & mask;
+        while (hash[b] != NULL)
+            b = (b + 1) & mask;
+        hash[b] = reg->objects[i];
+    }
+
+    free(reg->hash);
+    reg->hash  = hash;
+    reg->nhash = size;
+
+    return 0;
+}
+
+
+/********************
+ * registry_slot
+ ********************/
+static int
+registry_slot(registry_t *reg)
+{
+    void         **objects;
+    unsigned int  *gens;
+    int           *next;
+    int            i, nslot;
+
+    /*
+     * Notes:
+     *     Free slots are chained through next, so taking one is O(1).
+     *     Handles store slot + 1 in the low bits, so there can be at
+     *     most SLOT_MASK slots.
+     */
+
+    if (reg->free) {
+        i         = reg->free - 1;
+        reg->free = reg->next[i];
+        return i;
+    }
+
+    if (reg->nslot >= SLOT_MASK)
+        return -1;
+
+    nslot = reg->nslot ? 2 * reg->nslot : 16;
+    if (nslot > SLOT_MASK)
+        nslot = SLOT_MASK;
+    if ((objects = realloc(reg->objects, nslot * sizeof(*objects))) == NULL)
+        return -1;
+    reg->objects = objects;
+    if ((gens = realloc(reg->gens, nslot * sizeof(*gens))) == NULL)
+        return -1;
+    reg->gens = gens;
+    if ((next = realloc(reg->next, nslot * sizeof(*next))) == NULL)
+        return -1;
+    reg->next = next;
+
+    memset(objects + reg->nslot, 0, (nslot - reg->nslot) * sizeof(*objects));
+    memset(gens + reg->nslot, 0, (nslot - reg->nslot) * sizeof(*gens));
+
+    /* hand out the first new slot, chain the rest */
+    for (i = nslot - 1; i > reg->nslot; i--) {
+        next[i]   = reg->free;
+        reg->free = i + 1;
+    }
+    i          = reg->nslot;
+    reg->nslot = nslot;
+
+    return i;
+}
+
+
+/********************
+ * registry_add
+ ********************/
+int
+registry_add(registry_t *reg, void *obj)
+{
+    unsigned int mask, b;
+    int          slot;
+
+    if (registry_lookup(reg, NAME(reg, obj)) != NULL)
+        return EEXIST;
+
+    if (2 * (reg->nobject + 1) > reg->nhash)
+        if (registry_rehash(reg, reg->nhash ? 2 * reg->nhash : HASH_MIN))
+            return ENOMEM;
+
+    if ((slot = registry_slot(reg)) < 0)
+        return ENOMEM;
+
+    reg->objects[slot] = obj;
+    reg->gens[slot]    = (reg->gens[slot] + 1) & GEN_MASK;
+    HANDLE(reg, obj)   = (reg->gens[slot] << SLOT_BITS) | (slot + 1);
+
+    mask = reg->nhash - 1;
+    for (b = name_hash(NAME(reg, obj)) & mask; reg->hash[b]; b = (b + 1) & mask)
+        ;
+    reg->hash[b] = obj;
+    reg->nobject++;
+
+    return 0;
+}
+
+
+/********************
+ * registry_del
+ ********************/
+void
+registry_del(registry_t *reg, void *obj)
+{
+    unsigned int mask, b, n, home;
+    int          slot;
+
+    if (registry_find(reg, HANDLE(reg, obj)) != obj)
+        return;
+
+    slot = (HANDLE(reg, obj) & SLOT_MASK) - 1;
+    reg->objects[slot] = NULL;
+    reg->next[slot]    = reg->free;
+    reg->free          = slot + 1;
+    HANDLE(reg, obj)   = 0;
+
+    mask = reg->nhash - 1;
+    for (b = name_hash(NAME(reg, obj)) & mask; reg->hash[b] != obj;
+         b = (b + 1) & mask)
+        ;
+
+    /* backward shift deletion, no tombstones */
+    for (n = (b + 1) & mask; reg->hash[n] != NULL; n = (n + 1) & mask) {
+        home = name_hash(NAME(reg, reg->hash[n])) & mask;
+        if (((n - home) & mask) >= ((n - b) & mask)) {
+            reg->hash[b] = reg->hash[n];
+            b = n;
+        }
+    }
+    reg->hash[b] = NULL;
+    reg->nobject--;
+}
+
+
+/********************
+ * registry_lookup
+ ********************/
+void *
+registry_lookup(registry_t *reg, const char *name)
+{
+    unsigned int mask, b;
+
+    if (reg->hash == NULL)
+        return NULL;
+
+    mask = reg->nhash - 1;
+    for (b = name_hash(name) & mask; reg->hash[b] != NULL; b = (b + 1) & mask)
+        if (!strcmp(NAME(reg, reg->hash[b]), name))
+            return reg->hash[b];
+
+    return NULL;
+}
+
+
+/********************
+ * registry_find
+ ********************/
+void *
+registry_find(registry_t *reg, int handle)
+{
+    int          slot = (handle & SLOT_MASK) - 1;
+    unsigned int gen  = (unsigned int)handle >> SLOT_BITS;
+
+    if (slot < 0 || slot >= reg->nslot || reg->gens[slot] != gen)
+        return NULL;
+    else
+        return reg->objects[slot];
+}
+
+
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+*/
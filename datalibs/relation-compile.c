@@ -0,0 +1,198 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+/*
+ * relation-compile: compile a static relation into a mappable file
+ *
+ * The input has one tuple per line with the items separated by commas.
+ * Leading and trailing whitespace is ignored around items, as are empty
+ * lines and lines starting with '#'. All tuples must have the same arity.
+ * The resulting file can be mapped in with relation_map().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <prolog/relation.h>
+
+#define MAX_ARITY 32
+
+
+/********************
+ * usage
+ ********************/
+static void
+usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [-n name] input output\n"
+           "  -n name: name of the relation (default: basename of input)\n",
+           argv0);
+    exit(exit_code);
+}
+
+
+/********************
+ * strip
+ ********************/
+static char *
+strip(char *s)
+{
+    char *e;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    for (e = s + strlen(s); e > s && isspace((unsigned char)e[-1]); e--)
+        ;
+    *e = '\0';
+
+    return s;
+}
+
+
+/********************
+ * split
+ ********************/
+static int
+split(char *line, char **items)
+{
+    char *p, *next;
+    int   n;
+
+    for (n = 0, p = line; p != NULL; p = next, n++) {
+        if ((next = strchr(p, ',')) != NULL)
+            *next++ = '\0';
+        if (n >= MAX_ARITY)
+            return -1;
+        items[n] = strip(p);
+    }
+
+    return n;
+}
+
+
+/********************
+ * main
+ ********************/
+int
+main(int argc, char *argv[])
+{
+    relation_t *r;
+    FILE       *fp;
+    char        line[1024], name[256], *items[MAX_ARITY], *p, *s;
+    int         arity, n, lineno, status;
+
+    name[0] = '\0';
+
+    if (argc == 5 && !strcmp(argv[1], "-n")) {
+        snprintf(name, sizeof(name), "%s", argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc != 3)
+        usage(argv[0], 1);
+
+    if (name[0] == '\0') {
+        p = (p = strrchr(argv[1], '/')) ? p + 1 : argv[1];
+        snprintf(name, sizeof(name), "%s", p);
+        if ((p = strrchr(name, '.')) != NULL && p != name)
+            *p = '\0';
+    }
+
+    if ((fp = fopen(argv[1], "r")) == NULL) {
+        fprintf(stderr, "failed to open %s (%d: %s)\n",
+                argv[1], errno, strerror(errno));
+        exit(1);
+    }
+
+    r      = NULL;
+    arity  = 0;
+    lineno = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+
+        if (strchr(line, '\n') == NULL && getc(fp) != EOF) {
+            fprintf(stderr, "%s:%d: line too long\n", argv[1], lineno);
+            exit(1);
+        }
+
+        s = strip(line);
+        if (!*s || *s == '#')
+            continue;
+
+        if ((n = split(s, items)) < 0) {
+            fprintf(stderr, "%s:%d: too many items\n", argv[1], lineno);
+            exit(1);
+        }
+
+        if (r == NULL) {
+            arity = n;
+            if ((r = relation_create(name, arity, NULL)) == NULL) {
+                fprintf(stderr, "failed to create relation %s\n", name);
+                exit(1);
+            }
+        }
+        else if (n != arity) {
+            fprintf(stderr, "%s:%d: expected %d items, got %d\n",
+                    argv[1], lineno, arity, n);
+            exit(1);
+        }
+
+        if ((status = relation_insert(r, items)) != 0) {
+            fprintf(stderr, "%s:%d: failed to insert tuple (%d: %s)\n",
+                    argv[1], lineno, status, strerror(status));
+            exit(1);
+        }
+    }
+
+    fclose(fp);
+
+    if (r == NULL) {
+        fprintf(stderr, "%s: no tuples found\n", argv[1]);
+        exit(1);
+    }
+
+    if ((status = relation_save(r, argv[2])) != 0) {
+        fprintf(stderr, "failed to save relation to %s (%d: %s)\n",
+                argv[2], status, strerror(status));
+        exit(1);
+    }
+
+    printf("%s: %d tuples, %d items\n", name, r->nrelation, r->nitem);
+    relation_destroy(r);
+
+    return 0;
+}
+
+
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+*/
@@ -25,6 +25,19 @@ USA.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#endif
 
 #include <prolog/list.h>
 #include <prolog/relation.h>
@@ -35,6 +48,11 @@ USA.
 #define DONT_ADD 0
 #define AUTO_ADD 1
 
+#define REFRESH(r) do { if ((r)->stale) relation_refresh(r); } while (0)
+
+#define SHARED_ROWS  0x1                   /* tuple array seen by a snapshot */
+#define SHARED_ITEMS 0x2                   /* item array seen by a snapshot */
+
 #define ALLOC(type) ({                            \
             type   *__ptr;                        \
             size_t  __size = sizeof(type);        \
@@ -56,28 +74,95 @@ USA.
             size_t      __size = sizeof(*ptr) * (n);                    \
                                                                         \
             if ((ptr) == NULL)                                          \
-                (ptr) = ALLOC_ARR(typeof(*ptr), n);                     \
+                __ptr = (ptr) = ALLOC_ARR(typeof(*ptr), n);             \
             else if ((__ptr = realloc(ptr, __size)) != NULL) {          \
                 if ((n) > (o))                                          \
                     memset(__ptr + (o), 0, ((n)-(o)) * sizeof(*ptr));   \
                 ptr = __ptr;                                            \
             }                                                           \
-            ptr; })
+            __ptr; })
                 
 #define FREE(obj) do { if (obj) free(obj); } while (0)
 
 #define STRDUP(s) strdup(s)
 
+#define HASH_MIN 16
+
+#define RELATION_MAGIC   0x4c524c50                 /* 'PLRL' in native order */
+#define RELATION_VERSION 1
+#define RELATION_ALIGN   8
+
+typedef struct {
+    uint32_t magic;                              /* RELATION_MAGIC */
+    uint32_t version;                            /* RELATION_VERSION */
+    uint32_t size;                               /* total file size */
+    uint32_t arity;                              /* relation arity */
+    uint32_t nitem;                              /* number of items */
+    uint32_t nrelation;                          /* number of tuples */
+    uint32_t ntuplehash;                         /* size of tuple hash */
+    uint32_t name;                               /* offset of name */
+    uint32_t items;                              /* offset of item offsets */
+    uint32_t rows;                               /* offset of tuples */
+    uint32_t columns;                            /* offset of columns */
+    uint32_t tuplehash;                          /* offset of tuple hash */
+} relation_file_t;
+
+static void relation_refresh(relation_t *r);
+
 static int items_to_relation(relation_t *r, char **items,
                              int *relation, int auto_add);
 static int item_id(relation_t *r, char *item, int auto_add);
+static int item_local(relation_t *r, item_t item);
+static int item_rehash(relation_t *r, int size);
+
+static int  tuple_rehash(relation_t *r, int size);
+static int  tuple_find(relation_t *r, int *relation);
+static int  tuple_grow(relation_t *r);
+static void tuple_add(relation_t *r, int slot);
+static void tuple_del(relation_t *r, int slot);
+
+static int  rows_resize(relation_t *r, int nslot);
+static int  items_resize(relation_t *r, int nslot);
+
+static int  posting_add(relation_posting_t *p, int slot);
+static void posting_del(relation_t *r, int column, int slot);
+static int  index_grow(relation_t *r);
+static int  index_add(relation_t *r, int slot);
+static void index_del(relation_t *r, int slot);
+static void index_move(relation_t *r, int from, int to);
+static void index_free(relation_t *r);
+static int  index_build(relation_t *r, int column);
+
+static void relation_unmap(relation_t *r);
 
+enum {
+    GARBAGE_ROW = 0,                             /* a deleted tuple */
+    GARBAGE_ROWS,                                /* all tuples of a relation */
+    GARBAGE_ITEMS,                               /* all items of a relation */
+    GARBAGE_MAP,                                 /* a mapped relation file */
+    GARBAGE_ARRAY,                               /* a replaced array */
+};
 
+struct relation_garbage_s {
+    relation_garbage_t *next;                    /* more garbage */
+    unsigned int        epoch;                   /* epoch it became garbage */
+    int                 type;                    /* GARBAGE_* */
+    void               *ptr;                     /* memory to reclaim */
+    size_t              n;                       /* number of entries/size */
+};
 
+static void garbage_add(relation_t *r, int type, void *ptr, size_t n);
+static void garbage_reclaim(relation_t *r);
 
+static int  column_grow(relation_t *r, int nslot);
+static int  column_scan(relation_t *r, int *ids, int slot);
 
 
-static LIST_HOOK(relations);
+
+
+
+
+static registry_t relations = REGISTRY_INIT(relation_t);
 
 
 
@@ -88,7 +173,6 @@ relation_t *
 relation_create(char *name, int arity, char ***initial_items)
 {
     relation_t *r;
-    int         i;
     
     if (relation_lookup(name) != NULL)
         return NULL;
@@ -96,19 +180,18 @@ relation_create(char *name, int arity, char ***initial_items)
     if ((r = ALLOC(relation_t)) == NULL)
         goto fail;
     
-    list_hook_init(&r->hook);
     r->arity = arity;
 
     if ((r->name = STRDUP(name)) == NULL)
         goto fail;
 
     if (initial_items != NULL)
-        for (i = 0; initial_items[i]; i++) {
-            if (relation_insert(r, initial_items[i]))
-                goto fail;
-        }
+        if (relation_insert_many(r, initial_items))
+            goto fail;
     
-    list_add_tail(&r->hook, &relations);
+    if (registry_add(&relations, r))
+        goto fail;
+
     return r;
 
  fail:
@@ -123,23 +206,20 @@ relation_create(char *name, int arity, char ***initial_items)
 void
 relation_destroy(relation_t *r)
 {
-    int i;
-    
     if (r == NULL)
         return;
     
-    list_delete(&r->hook);
+    registry_del(&relations, r);
     
-    if (r->name)
-        FREE(r->name);
-    if (r->items) {
-        for (i = 0; r->items[i]; i++)
-            FREE(r->items[i]);
-        FREE(r->items);
+    relation_reset(r);
+
+    if (r->snapshots != NULL) {              /* freed by the last reader */
+        r->destroyed = 1;
+        return;
     }
-    if (r->relations)
-        FREE(r->relations);
-    
+
+    FREE(r->types);
+    FREE(r->name);
     FREE(r);
 }
 
@@ -150,16 +230,17 @@ relation_destroy(relation_t *r)
 relation_t *
 relation_lookup(char *name)
 {
-    relation_t  *r;
-    list_hook_t *p;
+    return registry_lookup(&relations, name);
+}
 
-    list_iter_forw(p, &relations) {
-        r = list_entry(p, relation_t, hook);
-        if (!strcmp(r->name, name))
-            return r;
-    }
-    
-    return NULL;
+
+/********************
+ * relation_find
+ ********************/
+relation_t *
+relation_find(int handle)
+{
+    return registry_find(&relations, handle);
 }
 
 
@@ -169,29 +250,133 @@ relation_lookup(char *name)
 int
 relation_insert(relation_t *r, char **items)
 {
-    int *relation;
+    int *relation, nslot, i, status;
     
-    if (relation_member(r, items))
+    if (r->map != NULL)
+        return EROFS;
+
+    if ((relation = ALLOC_ARR(int, r->arity)) == NULL)
+        return ENOMEM;
+
+    if (!items_to_relation(r, items, relation, DONT_ADD) &&
+        tuple_find(r, relation) >= 0) {
+        FREE(relation);
         return 0;                                   /* hmm... EEXIST ? */
+    }
 
-    if ((relation = ALLOC_ARR(int, r->arity)) == NULL ||
-        items_to_relation(r, items, relation, AUTO_ADD))
+    if ((status = items_to_relation(r, items, relation, AUTO_ADD)) != 0 ||
+        (status = tuple_grow(r)) != 0)
         goto fail;
+
+    status = ENOMEM;
     
     if (r->nrelation >= r->nslot) {
-        if (REALLOC_ARR(r->relations, r->nrelation, r->nrelation + 1) == NULL)
-            return ENOMEM;
-        r->nslot = r->nrelation + 1;
+        nslot = r->nslot ? 2 * r->nslot : 4;
+        if (rows_resize(r, nslot) || column_grow(r, nslot))
+            goto fail;
+        r->nslot = nslot;
     }
     
+    r->epoch++;
     r->relations[r->nrelation] = relation;
+    for (i = 0; i < r->arity; i++)
+        r->columns[i][r->nrelation] = relation[i];
+    tuple_add(r, r->nrelation);
+
+    if (index_add(r, r->nrelation))          /* indexes are just a cache */
+        index_free(r);
+
     r->nrelation++;
     
     return 0;
 
  fail:
     FREE(relation);
-    return ENOMEM;
+    return status;
+}
+
+
+/********************
+ * relation_insert_many
+ ********************/
+int
+relation_insert_many(relation_t *r, char ***items)
+{
+    int  indexed[r->arity];
+    int *relation, n, nslot, size, i, c, status;
+
+    /*
+     * Insert a NULL-terminated array of tuples. Storage and the tuple
+     * hash are sized once for all of them, duplicates are weeded out by
+     * the tuple hash as we go and any indexes are rebuilt at the end.
+     */
+
+    if (r->map != NULL)
+        return EROFS;
+
+    for (n = 0; items[n] != NULL; n++)
+        ;
+
+    if (n == 0)
+        return 0;
+
+    for (c = 0; c < r->arity; c++)
+        indexed[c] = r->index != NULL && r->index[c] != NULL;
+    index_free(r);
+
+    status = ENOMEM;
+
+    if (r->nrelation + n > r->nslot) {
+        for (nslot = r->nslot ? r->nslot : 4; nslot < r->nrelation + n; )
+            nslot *= 2;
+        if (rows_resize(r, nslot) || column_grow(r, nslot))
+            goto out;
+        r->nslot = nslot;
+    }
+
+    for (size = r->ntuplehash ? r->ntuplehash : HASH_MIN;
+         2 * (r->nrelation + n) > size; size *= 2)
+        ;
+    if (size != r->ntuplehash && tuple_rehash(r, size))
+        goto out;
+
+    relation = NULL;
+    for (i = 0; i < n; i++) {
+        if (relation == NULL)
+            if ((relation = ALLOC_ARR(int, r->arity)) == NULL) {
+                status = ENOMEM;
+                goto out;
+            }
+
+        if ((status = items_to_relation(r, items[i], relation, AUTO_ADD))) {
+            FREE(relation);
+            goto out;
+        }
+
+        if (tuple_find(r, relation) >= 0)      /* duplicate, reuse the row */
+            continue;
+
+        r->epoch++;
+        r->relations[r->nrelation] = relation;
+        for (c = 0; c < r->arity; c++)
+            r->columns[c][r->nrelation] = relation[c];
+        tuple_add(r, r->nrelation);
+        r->nrelation++;
+
+        relation = NULL;
+    }
+    FREE(relation);
+
+    status = 0;
+
+ out:
+    for (c = 0; c < r->arity; c++)              /* indexes are just a cache */
+        if (indexed[c] && index_build(r, c)) {
+            index_free(r);
+            break;
+        }
+
+    return status;
 }
 
 
@@ -201,24 +386,45 @@ relation_insert(relation_t *r, char **items)
 int
 relation_delete(relation_t *r, char **items)
 {
-    int slot, i;
-    
-    for (slot = 0; slot < r->nrelation; slot++) {
-        for (i = 0; i < r->arity && items[i]; i++)
-            if (strcmp(r->items[r->relations[slot][i]], items[i]))
-                break;
-        if (i == r->arity || !items[i])  /* full or full given match */
-            break;
+    int relation[r->arity];
+    int slot, i, n;
+
+    if (r->map != NULL)
+        return EROFS;
+
+    for (n = 0; n < r->arity && items[n]; n++)
+        if ((relation[n] = item_id(r, items[n], DONT_ADD)) == NOID)
+            return ENOENT;
+
+    if (n == r->arity)                                   /* full match */
+        slot = tuple_find(r, relation);
+    else {                                        /* full given match */
+        for (i = n; i < r->arity; i++)
+            relation[i] = -1;
+        slot = column_scan(r, relation, 0);
     }
 
-    if (slot >= r->nrelation)
+    if (slot < 0 || slot >= r->nrelation)
         return ENOENT;
 
-    FREE(r->relations[slot]);
+    /* the last tuple is moved over the deleted one, unshare the rows */
+    if ((r->shared & SHARED_ROWS) && rows_resize(r, r->nslot))
+        return ENOMEM;
+
+    r->epoch++;
+    tuple_del(r, slot);
+    index_del(r, slot);
+    garbage_add(r, GARBAGE_ROW, r->relations[slot], 1);
     r->nrelation--;
     
-    if (slot != r->nrelation)              /* if not last, replace with last */
+    if (slot != r->nrelation) {            /* if not last, replace with last */
+        tuple_del(r, r->nrelation);
+        index_move(r, r->nrelation, slot);
         r->relations[slot] = r->relations[r->nrelation];
+        for (i = 0; i < r->arity; i++)
+            r->columns[i][slot] = r->columns[i][r->nrelation];
+        tuple_add(r, slot);
+    }
     
     return 0;
 }
@@ -232,20 +438,36 @@ relation_reset(relation_t *r)
 {
     int i;
 
-    r->nrelation = 0;
+    r->epoch++;
+    index_free(r);
+    relation_unmap(r);
+
     if (r->items) {
-        for (i = 0; r->items[i]; i++)
-            FREE(r->items[i]);
-        FREE(r->items);
+        garbage_add(r, GARBAGE_ITEMS, r->items, r->nitem);
         r->items = NULL;
     }
     if (r->relations) {
-        for (i = 0; i < r->nrelation; i++)
-            FREE(r->relations[i]);
-        FREE(r->relations);
+        garbage_add(r, GARBAGE_ROWS, r->relations, r->nrelation);
         r->relations = NULL;
         r->nslot     = 0;
     }
+    if (r->columns) {
+        for (i = 0; i < r->arity; i++)
+            FREE(r->columns[i]);
+        FREE(r->columns);
+        r->columns = NULL;
+    }
+    r->nrelation = 0;
+    r->nitem     = 0;
+    r->nitemslot = 0;
+    r->shared    = 0;
+
+    FREE(r->itemhash);
+    r->itemhash  = NULL;
+    r->nitemhash = 0;
+    FREE(r->tuplehash);
+    r->tuplehash  = NULL;
+    r->ntuplehash = 0;
 }
 
 
@@ -255,17 +477,14 @@ relation_reset(relation_t *r)
 int
 relation_member(relation_t *r, char **items)
 {
-    int slot, i;
-    
-    for (slot = 0; slot < r->nrelation; slot++) {
-        for (i = 0; i < r->arity; i++)
-            if (strcmp(r->items[r->relations[slot][i]], items[i]))
-                break;
-        if (i == r->arity)
-            return 1;
-    }
+    int relation[r->arity];
 
-    return 0;
+    REFRESH(r);
+
+    if (items_to_relation(r, items, relation, DONT_ADD))
+        return 0;
+
+    return tuple_find(r, relation) >= 0;
 }
 
 
@@ -278,6 +497,8 @@ relation_dump(relation_t *r)
     int   slot, i;
     char *t;
 
+    REFRESH(r);
+
     for (slot = 0; slot < r->nrelation; slot++) {
         printf("%s(", r->name);
         t = "";
@@ -291,137 +512,2045 @@ relation_dump(relation_t *r)
 
 
 /********************
- * items_to_relation
+ * relation_item
  ********************/
-static int
-items_to_relation(relation_t *r, char **items, int *relation, int auto_add)
+int
+relation_item(relation_t *r, char *item)
 {
-    int i, item;
+    int id;
+
+    REFRESH(r);
+
+    id = item_id(r, item, DONT_ADD);
+    return id == NOID ? -1 : id;
+}
+
+
+/********************
+ * relation_postings
+ ********************/
+int
+relation_postings(relation_t *r, int column, int item, int **slots)
+{
+    relation_posting_t *p;
+
+    /*
+     * Return the tuples which have item in the given column, building
+     * an index for the column if we don't have one yet.
+     */
+
+    *slots = NULL;
+
+    REFRESH(r);
+
+    if (column < 0 || column >= r->arity || item < 0 || item >= r->nitem)
+        return -EINVAL;
+
+    if (r->index == NULL || r->index[column] == NULL)
+        if (index_build(r, column))
+            return -ENOMEM;
+
+    p = r->index[column] + item;
+    *slots = p->slots;
+
+    return p->nslot;
+}
+
+
+/********************
+ * relation_select
+ ********************/
+int
+relation_select(relation_t *r, char **items, int *slots, int nslot)
+{
+    int ids[r->arity];
+    int slot, i, n;
+
+    /*
+     * Collect the tuples matching items, NULL items matching anything.
+     * At most nslot matching tuples are stored in slots but the total
+     * number of matches is returned, much like snprintf(3) does.
+     */
+
+    REFRESH(r);
 
     for (i = 0; i < r->arity; i++) {
-        if ((item = item_id(r, items[i], auto_add)) == NOID)
-            return ENOENT;
-        relation[i] = item;
+        if (items[i] == NULL)
+            ids[i] = -1;
+        else if ((ids[i] = item_id(r, items[i], DONT_ADD)) == NOID)
+            return 0;
     }
 
-    return 0;
+    for (n = 0, slot = 0; (slot = column_scan(r, ids, slot)) >= 0; slot++) {
+        if (n < nslot)
+            slots[n] = slot;
+        n++;
+    }
+
+    return n;
 }
 
 
 /********************
- * item_id
+ * relation_join
  ********************/
-static int
-item_id(relation_t *r, char *item, int auto_add)
+int
+relation_join(relation_t *left, int lcolumn, relation_t *right, int rcolumn,
+              relation_pair_t **pairs)
 {
-    int i;
-    
-    if (r->items == NULL) {
-        if (!auto_add)
-            return NOID;
-        if ((r->items = ALLOC_ARR(char *, 2)) == NULL)
-            return NOID;
-        i = 0;
+    relation_posting_t *p;
+    relation_pair_t    *pair;
+    int                *xlate, npair, size, slot, id, i;
+
+    /*
+     * Collect the pairs of tuples from left and right that have the same
+     * item in lcolumn and rcolumn. The column index of right serves as
+     * the hash table for the join and each item of left is translated to
+     * the corresponding item of right only once, so the whole join costs
+     * O(n + m + number of pairs).
+     */
+
+    *pairs = NULL;
+
+    REFRESH(left);
+    REFRESH(right);
+
+    if (lcolumn < 0 || lcolumn >= left->arity ||
+        rcolumn < 0 || rcolumn >= right->arity)
+        return -EINVAL;
+
+    if (left->nrelation == 0 || right->nrelation == 0)
+        return 0;
+
+    if (right->index == NULL || right->index[rcolumn] == NULL)
+        if (index_build(right, rcolumn))
+            return -ENOMEM;
+
+    if ((xlate = ALLOC_ARR(int, left->nitem)) == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < left->nitem; i++)
+        xlate[i] = -2;                                      /* unknown yet */
+
+    npair = size = 0;
+    pair  = NULL;
+
+    for (slot = 0; slot < left->nrelation; slot++) {
+        id = left->columns[lcolumn][slot];
+
+        if (xlate[id] == -2)
+            xlate[id] = item_local(right, left->items[id]);
+        if (xlate[id] == (int)NOID)
+            continue;
+
+        p = right->index[rcolumn] + xlate[id];
+        if (npair + p->nslot > size) {
+            for (i = size ? size : 16; i < npair + p->nslot; i *= 2)
+                ;
+            if (REALLOC_ARR(pair, size, i) == NULL) {
+                FREE(pair);
+                FREE(xlate);
+                return -ENOMEM;
+            }
+            size = i;
+        }
+
+        for (i = 0; i < p->nslot; i++, npair++) {
+            pair[npair].left  = slot;
+            pair[npair].right = p->slots[i];
+        }
     }
-    else {
-        for (i = 0; r->items[i]; i++)
-            if (!strcmp(r->items[i], item))
-                return i;
-    
-        if (!auto_add)
-            return NOID;
-    
-        if (REALLOC_ARR(r->items, i + 1, i + 2) == NULL)
-            return NOID;
-    }    
-     
-    if ((r->items[i] = STRDUP(item)) == NULL)
-        return NOID;
-    
-    return i;
-}
 
+    FREE(xlate);
+
+    *pairs = pair;
+    return npair;
+}
 
-#ifdef __TEST__
 
+/********************
+ * relation_set_types
+ ********************/
 int
-main(int argc, char *argv[])
+relation_set_types(relation_t *r, item_type_t *types)
 {
-#define fatal(ec, fmt, args...) do {              \
-        printf("fatal error: "fmt".\n", ## args); \
-        exit(ec);                                 \
-    } while (0)
-    
+    int i;
 
-    char *chair[]  = { "chair" , "room"       , "floor" };
-    char *laptop[] = { "laptop", "room"       , "table" };
-    char *iriver[] = { "iriver", "study"      , "mousepad" };
-    char *tv[]     = { "TV"    , "living room", "TV-stand" };
-    char *htpc[]   = { "HTPC"  , "TV-stand"   , "bottom"   };
-    char *fridge[] = { "fridge", "kitched"    , "floor"    };
-    char *micro[]  = { "micro" , "cupbord"    , "bottom"   };
-    char *bed[]    = { "bed"   , "bedroom"    , "floor"    };
-    char *pizza[]  = { "pizza" , "fridge"     , "shelf"    };
-    char *tub[]    = { "tub"   , "bathroom"   , "floor"    };
+    /*
+     * Column types can be set only once and only while the relation is
+     * empty. This way snapshots never see the types of their tuples change.
+     */
 
-    char **initial_items[] = { chair, laptop, iriver, NULL };
-    char **more_items[]    = { tv, htpc, fridge, micro, bed, pizza, tub, NULL };
-    char ***items;
+    if (r->types != NULL || r->nrelation > 0)
+        return EBUSY;
 
-    relation_t *test;
-    int         j, i;
+    for (i = 0; i < r->arity; i++)
+        if (types[i] != ITEM_STRING && types[i] != ITEM_INT &&
+            types[i] != ITEM_DOUBLE)
+            return EINVAL;
 
+    if ((r->types = ALLOC_ARR(item_type_t, r->arity)) == NULL)
+        return ENOMEM;
+    memcpy(r->types, types, r->arity * sizeof(r->types[0]));
 
-#define check() do {                                                          \
-        for (items = initial_items, j = 0; items[j]; j++)                     \
-            printf("  chk: (%s,%s,%s): %s\n",                                 \
-                   items[j][0], items[j][1], items[j][2],                     \
-                   relation_member(test, items[j]) ?  "yes" : "no");          \
-        for (items = more_items, j = 0; items[j]; j++)                        \
-            printf("  chk: (%s,%s,%s): %s\n",                                 \
-                   items[j][0], items[j][1], items[j][2],                     \
-                   relation_member(test, items[j]) ? "yes" : "no");           \
-    } while (0)
+    return 0;
+}
 
 
-    if ((test = relation_create("in,on_top_of", 3, initial_items)) == NULL)
-        fatal(1, "failed to create relation");
-    
-    for (i = 0; more_items[i]; i++) {
-        if (relation_insert(test, more_items[i]))
-            fatal(2, "failed to insert items");
-        printf("inserted (%s, %s, %s)\n",
-               more_items[i][0], more_items[i][1], more_items[i][2]);
-        relation_dump(test);
-        check();
-    }
+/********************
+ * relation_set_refresh
+ ********************/
+void
+relation_set_refresh(relation_t *r, int (*refresh)(relation_t *, void *),
+                     void *data)
+{
+    r->refresh      = refresh;
+    r->refresh_data = data;
+    r->stale        = 0;
+}
 
-    for (i = 0; initial_items[i]; i++) {
-        if (relation_delete(test, initial_items[i]))
-            fatal(2, "failed to delete items");
-        printf("deleted (%s, %s, %s)\n",
-               initial_items[i][0], initial_items[i][1], initial_items[i][2]);
-        relation_dump(test);
-        check();
-    }
 
-    for (i = 0; more_items[i]; i++) {
-        if (relation_delete(test, more_items[i]))
-            fatal(2, "failed to delete items");
-        printf("deleted (%s, %s, %s)\n",
-               more_items[i][0], more_items[i][1], more_items[i][2]);
-        relation_dump(test);
-        check();
-    }
+/********************
+ * relation_invalidate
+ ********************/
+void
+relation_invalidate(relation_t *r)
+{
+    r->stale = (r->refresh != NULL);
+}
 
-    relation_reset(test);
-    relation_destroy(test);
-    
+
+/********************
+ * relation_refresh
+ ********************/
+static void
+relation_refresh(relation_t *r)
+{
+    /*
+     * Clear the flag first, the callback is free to read the relation.
+     * If the refresh fails readers get the relation as it was, and
+     * they get another chance once it is invalidated again.
+     */
+
+    r->stale = 0;
+    r->refresh(r, r->refresh_data);
+}
+
+
+/*
+ * Notes:
+ *     Static relations can be saved to a file and later mapped back in
+ *     read-only. The file has a header, the relation name and item names,
+ *     the item name offsets, the tuples both row by row and column by
+ *     column, and the tuple hash. Everything is addressed by offsets from
+ *     the beginning of the file so it can be mapped anywhere. The magic
+ *     is in native byte order, so files written on a host with different
+ *     endianness are rejected.
+ *
+ *     Mapping a relation interns its items and hashes them, but the tuples
+ *     and the tuple hash are used straight from the mapped pages, which
+ *     can then be shared by all processes mapping the same file.
+ */
+
+
+/********************
+ * file_write
+ ********************/
+static int
+file_write(FILE *fp, const void *data, size_t size, uint32_t *offs)
+{
+    if (size > 0 && fwrite(data, size, 1, fp) != 1)
+        return EIO;
+
+    *offs += size;
     return 0;
 }
 
 
-#endif /* __TEST__ */
+/********************
+ * file_pad
+ ********************/
+static int
+file_pad(FILE *fp, uint32_t *offs)
+{
+    static const char pad[RELATION_ALIGN];
+    size_t            n;
+
+    n = (RELATION_ALIGN - (*offs % RELATION_ALIGN)) % RELATION_ALIGN;
+
+    return file_write(fp, pad, n, offs);
+}
+
+
+/********************
+ * relation_save
+ ********************/
+int
+relation_save(relation_t *r, const char *path)
+{
+    relation_file_t  hdr;
+    FILE            *fp;
+    char             tmp[PATH_MAX];
+    uint32_t        *offs, size;
+    int              status, i, c;
+
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+        return ENAMETOOLONG;
+
+    REFRESH(r);
+
+    if ((offs = ALLOC_ARR(uint32_t, r->nitem + 1)) == NULL)
+        return ENOMEM;
+
+    /* lay out the file */
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic      = RELATION_MAGIC;
+    hdr.version    = RELATION_VERSION;
+    hdr.arity      = r->arity;
+    hdr.nitem      = r->nitem;
+    hdr.nrelation  = r->nrelation;
+    hdr.ntuplehash = r->tuplehash ? r->ntuplehash : 0;
+
+#define ALIGNED(n) (((n) + RELATION_ALIGN - 1) & ~(RELATION_ALIGN - 1))
+    size     = ALIGNED(sizeof(hdr));
+    hdr.name = size;
+    size    += strlen(r->name) + 1;
+    for (i = 0; i < r->nitem; i++) {
+        offs[i] = size;
+        size   += strlen(r->items[i]) + 1;
+    }
+    size          = ALIGNED(size);
+    hdr.items     = size;
+    size          = ALIGNED(size + r->nitem * sizeof(uint32_t));
+    hdr.rows      = size;
+    size          = ALIGNED(size + r->nrelation * r->arity * sizeof(int32_t));
+    hdr.columns   = size;
+    size          = ALIGNED(size + r->nrelation * r->arity * sizeof(int32_t));
+    hdr.tuplehash = size;
+    size          = ALIGNED(size + hdr.ntuplehash * sizeof(int32_t));
+    hdr.size      = size;
+#undef ALIGNED
+
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        status = errno;
+        FREE(offs);
+        return status;
+    }
+
+    size   = 0;
+    status = file_write(fp, &hdr, sizeof(hdr), &size) || file_pad(fp, &size);
+
+    if (!status)
+        status = file_write(fp, r->name, strlen(r->name) + 1, &size);
+    for (i = 0; i < r->nitem && !status; i++)
+        status = file_write(fp, r->items[i], strlen(r->items[i]) + 1, &size);
+    if (!status)
+        status = file_pad(fp, &size) ||
+            file_write(fp, offs, r->nitem * sizeof(*offs), &size) ||
+            file_pad(fp, &size);
+    for (i = 0; i < r->nrelation && !status; i++)
+        status = file_write(fp, r->relations[i],
+                            r->arity * sizeof(int32_t), &size);
+    if (!status)
+        status = file_pad(fp, &size);
+    for (c = 0; c < r->arity && r->nrelation > 0 && !status; c++)
+        status = file_write(fp, r->columns[c],
+                            r->nrelation * sizeof(int32_t), &size);
+    if (!status)
+        status = file_pad(fp, &size) ||
+            file_write(fp, r->tuplehash,
+                       hdr.ntuplehash * sizeof(int32_t), &size) ||
+            file_pad(fp, &size);
+
+    if (status)
+        status = EIO;
+
+    if (!status && size != hdr.size)
+        status = EINVAL;
+
+    if (fclose(fp) != 0 && !status)
+        status = EIO;
+
+    if (!status && rename(tmp, path) != 0)
+        status = errno;
+
+    if (status)
+        unlink(tmp);
+
+    FREE(offs);
+    return status;
+}
+
+
+/********************
+ * relation_map
+ ********************/
+relation_t *
+relation_map(char *name, const char *path)
+{
+    relation_file_t *hdr;
+    relation_t      *r;
+    struct stat      st;
+    void            *map;
+    char            *base;
+    uint32_t        *offs, *ids, table;
+    int              fd, i, c;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    base = map;
+    hdr  = map;
+
+#define INSIDE(o, n) ((uint64_t)(o) + (uint64_t)(n) <= hdr->size)
+    if (hdr->magic != RELATION_MAGIC || hdr->version != RELATION_VERSION ||
+        hdr->size != (uint64_t)st.st_size || hdr->arity == 0 ||
+        (hdr->ntuplehash & (hdr->ntuplehash - 1)) ||
+        (hdr->nrelation > 0 && hdr->ntuplehash <= hdr->nrelation) ||
+        hdr->name >= hdr->size || !memchr(base + hdr->name, '\0',
+                                          hdr->size - hdr->name) ||
+        (hdr->items | hdr->rows | hdr->columns | hdr->tuplehash) % 4 ||
+        !INSIDE(hdr->items, (uint64_t)hdr->nitem * sizeof(uint32_t)) ||
+        !INSIDE(hdr->rows,
+                (uint64_t)hdr->nrelation * hdr->arity * sizeof(int32_t)) ||
+        !INSIDE(hdr->columns,
+                (uint64_t)hdr->nrelation * hdr->arity * sizeof(int32_t)) ||
+        !INSIDE(hdr->tuplehash, (uint64_t)hdr->ntuplehash * sizeof(int32_t)))
+        goto unmap;
+#undef INSIDE
+
+    offs = (uint32_t *)(base + hdr->items);
+    for (i = 0; i < (int)hdr->nitem; i++)
+        if (offs[i] >= hdr->size ||
+            !memchr(base + offs[i], '\0', hdr->size - offs[i]))
+            goto unmap;
+
+    /* a damaged file should not make us access memory out of bounds */
+    ids = (uint32_t *)(base + hdr->rows);
+    for (i = 0; i < (int)(hdr->nrelation * hdr->arity); i++)
+        if (ids[i] >= hdr->nitem)
+            goto unmap;
+    ids = (uint32_t *)(base + hdr->columns);
+    for (i = 0; i < (int)(hdr->nrelation * hdr->arity); i++)
+        if (ids[i] >= hdr->nitem)
+            goto unmap;
+    ids = (uint32_t *)(base + hdr->tuplehash);
+    for (i = 0; i < (int)hdr->ntuplehash; i++)
+        if (ids[i] > hdr->nrelation)
+            goto unmap;
+
+    if (name == NULL)
+        name = base + hdr->name;
+
+    if (relation_lookup(name) != NULL || (r = ALLOC(relation_t)) == NULL)
+        goto unmap;
+
+    r->map     = map;
+    r->mapsize = st.st_size;
+    r->arity   = hdr->arity;
+
+    if ((r->name = STRDUP(name)) == NULL)
+        goto fail;
+
+    /* intern and hash the items */
+    if ((r->items = ALLOC_ARR(item_t, hdr->nitem + 1)) == NULL)
+        goto fail;
+    r->nitemslot = hdr->nitem;
+
+    for (i = 0; i < (int)hdr->nitem; i++) {
+        if ((r->items[i] = item_intern(base + offs[i])) == NULL)
+            goto fail;
+        r->nitem++;
+    }
+
+    for (table = HASH_MIN; table < 2 * hdr->nitem; table *= 2)
+        ;
+    if (item_rehash(r, table))
+        goto fail;
+
+    /* use the tuples and the tuple hash from the mapping */
+    if ((r->relations = ALLOC_ARR(int *, hdr->nrelation + 1)) == NULL ||
+        (r->columns = ALLOC_ARR(int32_t *, r->arity)) == NULL)
+        goto fail;
+
+    for (i = 0; i < (int)hdr->nrelation; i++)
+        r->relations[i] = (int *)(base + hdr->rows) + i * r->arity;
+    for (c = 0; c < r->arity; c++)
+        r->columns[c] = (int32_t *)(base + hdr->columns) + c * hdr->nrelation;
+
+    r->nrelation  = hdr->nrelation;
+    r->nslot      = hdr->nrelation;
+    r->tuplehash  = hdr->ntuplehash ? (int *)(base + hdr->tuplehash) : NULL;
+    r->ntuplehash = hdr->ntuplehash;
+
+    if (registry_add(&relations, r))
+        goto fail;
+
+    return r;
+
+ fail:
+    relation_destroy(r);
+    return NULL;
+
+ unmap:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+
+/********************
+ * relation_unmap
+ ********************/
+static void
+relation_unmap(relation_t *r)
+{
+    if (r->map == NULL)
+        return;
+
+    garbage_add(r, GARBAGE_ARRAY, r->relations, 0);
+    FREE(r->columns);
+    r->shared    &= ~SHARED_ROWS;
+    r->relations  = NULL;
+    r->columns    = NULL;
+    r->nrelation  = 0;
+    r->nslot      = 0;
+    r->tuplehash  = NULL;
+    r->ntuplehash = 0;
+
+    garbage_add(r, GARBAGE_MAP, r->map, r->mapsize);
+    r->map     = NULL;
+    r->mapsize = 0;
+}
+
+
+/********************
+ * relation_snapshot
+ ********************/
+relation_snapshot_t *
+relation_snapshot(relation_t *r)
+{
+    relation_snapshot_t *s;
+
+    /*
+     * Tuples are never modified once inserted, only deleted or moved to
+     * another slot, and items are only ever appended. A snapshot simply
+     * shares the tuple and item arrays of the relation, which are then
+     * copied on write by the first mutation that would change the part
+     * of them the snapshot sees. Readers pinning the same epoch share a
+     * snapshot.
+     */
+
+    REFRESH(r);
+
+    if ((s = r->snapshots) != NULL && s->epoch == r->epoch) {
+        s->refcnt++;
+        return s;
+    }
+
+    if ((s = ALLOC(relation_snapshot_t)) == NULL)
+        return NULL;
+
+    s->r         = r;
+    s->refcnt    = 1;
+    s->epoch     = r->epoch;
+    s->arity     = r->arity;
+    s->nrelation = r->nrelation;
+    s->relations = r->relations;
+    s->items     = r->items;
+
+    if (r->relations != NULL)
+        r->shared |= SHARED_ROWS;
+    if (r->items != NULL)
+        r->shared |= SHARED_ITEMS;
+
+    s->next      = r->snapshots;
+    r->snapshots = s;
+
+    return s;
+}
+
+
+/********************
+ * relation_release
+ ********************/
+void
+relation_release(relation_snapshot_t *s)
+{
+    relation_snapshot_t **p;
+    relation_t           *r;
+
+    if (s == NULL || --s->refcnt > 0)
+        return;
+
+    r = s->r;
+    for (p = &r->snapshots; *p != NULL; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+
+    FREE(s);
+
+    garbage_reclaim(r);
+
+    if (r->destroyed && r->snapshots == NULL) {
+        FREE(r->types);
+        FREE(r->name);
+        FREE(r);
+    }
+}
+
+
+/********************
+ * garbage_free
+ ********************/
+static void
+garbage_free(int type, void *ptr, size_t n)
+{
+    size_t i;
+
+    switch (type) {
+    case GARBAGE_ROW:
+        FREE(ptr);
+        break;
+    case GARBAGE_ROWS:
+        for (i = 0; i < n; i++)
+            FREE(((int **)ptr)[i]);
+        FREE(ptr);
+        break;
+    case GARBAGE_ITEMS:
+        for (i = 0; i < n; i++)
+            item_unref(((item_t *)ptr)[i]);
+        FREE(ptr);
+        break;
+    case GARBAGE_MAP:
+        munmap(ptr, n);
+        break;
+    case GARBAGE_ARRAY:
+        FREE(ptr);
+        break;
+    }
+}
+
+
+/********************
+ * garbage_add
+ ********************/
+static void
+garbage_add(relation_t *r, int type, void *ptr, size_t n)
+{
+    relation_garbage_t *g;
+
+    if (r->snapshots == NULL) {
+        garbage_free(type, ptr, n);
+        return;
+    }
+
+    /* if we cannot keep track of it, leaking is better than crashing */
+    if ((g = ALLOC(relation_garbage_t)) == NULL)
+        return;
+
+    g->epoch   = r->epoch;
+    g->type    = type;
+    g->ptr     = ptr;
+    g->n       = n;
+    g->next    = r->garbage;
+    r->garbage = g;
+}
+
+
+/********************
+ * garbage_reclaim
+ ********************/
+static void
+garbage_reclaim(relation_t *r)
+{
+    relation_snapshot_t  *s;
+    relation_garbage_t  **p, *g;
+    unsigned int          oldest;
+
+    /*
+     * Garbage from epoch E was visible to snapshots older than E. Once
+     * every snapshot still pinned is at least as recent, reclaim it.
+     */
+
+    oldest = r->epoch;
+    for (s = r->snapshots; s != NULL; s = s->next)
+        if (s->epoch < oldest)
+            oldest = s->epoch;
+
+    p = &r->garbage;
+    while ((g = *p) != NULL) {
+        if (r->snapshots == NULL || g->epoch <= oldest) {
+            *p = g->next;
+            garbage_free(g->type, g->ptr, g->n);
+            FREE(g);
+        }
+        else
+            p = &g->next;
+    }
+}
+
+
+/********************
+ * type_check
+ ********************/
+static inline int
+type_check(item_type_t type, char *name)
+{
+    switch (type) {
+    case ITEM_STRING: return 1;
+    case ITEM_INT:    return item_name_type(name) == ITEM_INT;
+    case ITEM_DOUBLE: return item_name_type(name) != ITEM_STRING;
+    default:          return 0;
+    }
+}
+
+
+/********************
+ * items_to_relation
+ ********************/
+static int
+items_to_relation(relation_t *r, char **items, int *relation, int auto_add)
+{
+    int i, item;
+
+    /* check every column before adding any item to the dictionary */
+    if (r->types != NULL)
+        for (i = 0; i < r->arity; i++)
+            if (!type_check(r->types[i], items[i]))
+                return EINVAL;
+
+    for (i = 0; i < r->arity; i++) {
+        if ((item = item_id(r, items[i], auto_add)) == NOID)
+            return ENOENT;
+        relation[i] = item;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Notes:
+ *     Both the item dictionary and the set of tuples are hashed using
+ *     open addressing with linear probing. Buckets hold the item id or
+ *     tuple slot plus one, zero marking an empty bucket. Tables are kept
+ *     a power of two in size and at most half full. Since tuples get
+ *     deleted we do backward shift deletion instead of using tombstones.
+ *     Items are interned so the dictionary hashes and compares pointers.
+ */
+
+
+/********************
+ * item_hash
+ ********************/
+static unsigned int
+item_hash(item_t item)
+{
+    unsigned long h = (unsigned long)item;
+
+    h ^= h >> 4;
+    return (unsigned int)(h * 2654435761U) ^ (unsigned int)(h >> 16);
+}
+
+
+/********************
+ * tuple_hash
+ ********************/
+static unsigned int
+tuple_hash(int *relation, int arity)
+{
+    unsigned int h = 2166136261U;
+    int          i;
+
+    for (i = 0; i < arity; i++)
+        h = (h ^ (unsigned int)relation[i]) * 16777619U;
+
+    return h ^ (h >> 15);
+}
+
+
+/********************
+ * item_rehash
+ ********************/
+static int
+item_rehash(relation_t *r, int size)
+{
+    int          *hash, i;
+    unsigned int  mask = size - 1, b;
+
+    if ((hash = ALLOC_ARR(int, size)) == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < r->nitem; i++) {
+        for (b = item_hash(r->items[i]) & mask; hash[b]; b = (b + 1) & mask)
+            ;
+        hash[b] = i + 1;
+    }
+
+    FREE(r->itemhash);
+    r->itemhash  = hash;
+    r->nitemhash = size;
+
+    return 0;
+}
+
+
+/********************
+ * item_local
+ ********************/
+static int
+item_local(relation_t *r, item_t item)
+{
+    unsigned int mask, b;
+    int          i;
+
+    if (r->itemhash == NULL)
+        return NOID;
+
+    mask = r->nitemhash - 1;
+    for (b = item_hash(item) & mask; r->itemhash[b]; b = (b + 1) & mask) {
+        i = r->itemhash[b] - 1;
+        if (r->items[i] == item)
+            return i;
+    }
+
+    return NOID;
+}
+
+
+/********************
+ * item_id
+ ********************/
+static int
+item_id(relation_t *r, char *name, int auto_add)
+{
+    item_t       item;
+    unsigned int mask, b;
+    int          i, nslot;
+
+    if ((item = item_find(name)) != NULL)
+        if ((i = item_local(r, item)) != (int)NOID)
+            return i;
+
+    if (!auto_add)
+        return NOID;
+
+    if (2 * (r->nitem + 1) > r->nitemhash)
+        if (item_rehash(r, r->nitemhash ? 2 * r->nitemhash : HASH_MIN))
+            return NOID;
+
+    if (r->nitem >= r->nitemslot) {
+        nslot = r->nitemslot ? 2 * r->nitemslot : 4;
+        if (items_resize(r, nslot))
+            return NOID;
+    }
+
+    i = r->nitem;
+    if ((r->items[i] = item = item_intern(name)) == NULL)
+        return NOID;
+    r->nitem++;
+
+    mask = r->nitemhash - 1;
+    for (b = item_hash(item) & mask; r->itemhash[b]; b = (b + 1) & mask)
+        ;
+    r->itemhash[b] = i + 1;
+    
+    return i;
+}
+
+
+/********************
+ * tuple_equal
+ ********************/
+static inline int
+tuple_equal(int *r1, int *r2, int arity)
+{
+    return !memcmp(r1, r2, arity * sizeof(*r1));
+}
+
+
+/********************
+ * tuple_rehash
+ ********************/
+static int
+tuple_rehash(relation_t *r, int size)
+{
+    int          *hash, i;
+    unsigned int  mask = size - 1, b;
+
+    if ((hash = ALLOC_ARR(int, size)) == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < r->nrelation; i++) {
+        b = tuple_hash(r->relations[i], r->arity) & mask;
+        while (hash[b])
+            b = (b + 1) & mask;
+        hash[b] = i + 1;
+    }
+
+    FREE(r->tuplehash);
+    r->tuplehash  = hash;
+    r->ntuplehash = size;
+
+    return 0;
+}
+
+
+/********************
+ * tuple_find
+ ********************/
+static int
+tuple_find(relation_t *r, int *relation)
+{
+    unsigned int mask, b;
+    int          slot;
+
+    if (r->tuplehash == NULL)
+        return -1;
+
+    mask = r->ntuplehash - 1;
+    for (b = tuple_hash(relation, r->arity) & mask;
+         r->tuplehash[b];
+         b = (b + 1) & mask) {
+        slot = r->tuplehash[b] - 1;
+        if (tuple_equal(r->relations[slot], relation, r->arity))
+            return slot;
+    }
+
+    return -1;
+}
+
+
+/********************
+ * tuple_grow
+ ********************/
+static int
+tuple_grow(relation_t *r)
+{
+    /* make sure there is room for one more tuple */
+    if (2 * (r->nrelation + 1) > r->ntuplehash)
+        return tuple_rehash(r, r->ntuplehash ? 2 * r->ntuplehash : HASH_MIN);
+    else
+        return 0;
+}
+
+
+/********************
+ * tuple_add
+ ********************/
+static void
+tuple_add(relation_t *r, int slot)
+{
+    unsigned int mask, b;
+
+    mask = r->ntuplehash - 1;
+    b    = tuple_hash(r->relations[slot], r->arity) & mask;
+    while (r->tuplehash[b])
+        b = (b + 1) & mask;
+    r->tuplehash[b] = slot + 1;
+}
+
+
+/********************
+ * tuple_del
+ ********************/
+static void
+tuple_del(relation_t *r, int slot)
+{
+    unsigned int mask, b, n, home;
+
+    mask = r->ntuplehash - 1;
+    b    = tuple_hash(r->relations[slot], r->arity) & mask;
+    while (r->tuplehash[b] != slot + 1) {
+        if (!r->tuplehash[b])
+            return;
+        b = (b + 1) & mask;
+    }
+
+    /* shift back any entries that would become unreachable */
+    for (n = (b + 1) & mask; r->tuplehash[n]; n = (n + 1) & mask) {
+        home = tuple_hash(r->relations[r->tuplehash[n] - 1], r->arity) & mask;
+        if (((n - home) & mask) >= ((n - b) & mask)) {
+            r->tuplehash[b] = r->tuplehash[n];
+            b = n;
+        }
+    }
+    r->tuplehash[b] = 0;
+}
+
+
+/********************
+ * rows_resize
+ ********************/
+static int
+rows_resize(relation_t *r, int nslot)
+{
+    int **rows;
+
+    /*
+     * Resize the tuple array, leaving r->nslot for the caller to update.
+     * If a pinned snapshot shares it, leave it to the snapshot and go on
+     * with a private copy instead.
+     */
+
+    if (!(r->shared & SHARED_ROWS)) {
+        if (REALLOC_ARR(r->relations, r->nslot, nslot) == NULL)
+            return ENOMEM;
+        return 0;
+    }
+
+    if ((rows = ALLOC_ARR(int *, nslot)) == NULL)
+        return ENOMEM;
+    memcpy(rows, r->relations, r->nrelation * sizeof(rows[0]));
+
+    r->epoch++;                            /* older snapshots keep the old */
+    garbage_add(r, GARBAGE_ARRAY, r->relations, 0);
+    r->relations = rows;
+    r->shared   &= ~SHARED_ROWS;
+
+    return 0;
+}
+
+
+/********************
+ * items_resize
+ ********************/
+static int
+items_resize(relation_t *r, int nslot)
+{
+    item_t *items;
+
+    /* like rows_resize, keeping the item array NULL-terminated */
+
+    if (!(r->shared & SHARED_ITEMS)) {
+        if (REALLOC_ARR(r->items, r->nitemslot + 1, nslot + 1) == NULL)
+            return ENOMEM;
+        r->nitemslot = nslot;
+        return 0;
+    }
+
+    if ((items = ALLOC_ARR(item_t, nslot + 1)) == NULL)
+        return ENOMEM;
+    memcpy(items, r->items, r->nitem * sizeof(items[0]));
+
+    r->epoch++;
+    garbage_add(r, GARBAGE_ARRAY, r->items, 0);
+    r->items     = items;
+    r->nitemslot = nslot;
+    r->shared   &= ~SHARED_ITEMS;
+
+    return 0;
+}
+
+
+/*
+ * Notes:
+ *     Besides the postings of an indexed column we keep the position of
+ *     each tuple within its posting, indexed by tuple slot just like the
+ *     column itself. A tuple is taken out of a posting by moving the last
+ *     entry of the posting over it, so deletes cost O(1) however many
+ *     tuples share the item. The order of the tuples in a posting is
+ *     therefore arbitrary.
+ */
+
+
+/********************
+ * posting_add
+ ********************/
+static int
+posting_add(relation_posting_t *p, int slot)
+{
+    int size;
+
+    if (p->nslot >= p->size) {
+        size = p->size ? 2 * p->size : 4;
+        if (REALLOC_ARR(p->slots, p->size, size) == NULL)
+            return ENOMEM;
+        p->size = size;
+    }
+
+    p->slots[p->nslot++] = slot;
+
+    return 0;
+}
+
+
+/********************
+ * posting_del
+ ********************/
+static void
+posting_del(relation_t *r, int column, int slot)
+{
+    relation_posting_t *p;
+    int                 i, last;
+
+    p = r->index[column] + r->relations[slot][column];
+    i = r->indexpos[column][slot];
+
+    if (i >= p->nslot || p->slots[i] != slot)       /* not in the index */
+        return;
+
+    last = p->slots[--p->nslot];
+    if (i != p->nslot) {
+        p->slots[i] = last;
+        r->indexpos[column][last] = i;
+    }
+}
+
+
+/********************
+ * index_grow
+ ********************/
+static int
+index_grow(relation_t *r)
+{
+    int c, size;
+
+    if (r->nindex >= r->nitem)
+        return 0;
+
+    size = r->nitemslot;
+    for (c = 0; c < r->arity; c++)
+        if (r->index[c] != NULL)
+            if (REALLOC_ARR(r->index[c], r->nindex, size) == NULL)
+                return ENOMEM;
+    r->nindex = size;
+
+    return 0;
+}
+
+
+/********************
+ * index_add
+ ********************/
+static int
+index_add(relation_t *r, int slot)
+{
+    relation_posting_t *p;
+    int                 c;
+
+    if (r->index == NULL)
+        return 0;
+
+    if (index_grow(r))
+        return ENOMEM;
+
+    for (c = 0; c < r->arity; c++) {
+        if (r->index[c] != NULL) {
+            p = r->index[c] + r->relations[slot][c];
+            if (posting_add(p, slot))
+                return ENOMEM;
+            r->indexpos[c][slot] = p->nslot - 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/********************
+ * index_del
+ ********************/
+static void
+index_del(relation_t *r, int slot)
+{
+    int c;
+
+    if (r->index == NULL)
+        return;
+
+    for (c = 0; c < r->arity; c++)
+        if (r->index[c] != NULL)
+            posting_del(r, c, slot);
+}
+
+
+/********************
+ * index_move
+ ********************/
+static void
+index_move(relation_t *r, int from, int to)
+{
+    relation_posting_t *p;
+    int                 c, i;
+
+    if (r->index == NULL)
+        return;
+
+    for (c = 0; c < r->arity; c++) {
+        if (r->index[c] == NULL)
+            continue;
+        p = r->index[c] + r->relations[from][c];
+        i = r->indexpos[c][from];
+        if (i < p->nslot && p->slots[i] == from) {
+            p->slots[i]        = to;
+            r->indexpos[c][to] = i;
+        }
+    }
+}
+
+
+/********************
+ * index_build
+ ********************/
+static int
+index_build(relation_t *r, int column)
+{
+    relation_posting_t *p;
+    int                 slot, *pos, id;
+
+    if (r->index == NULL) {
+        if ((r->index = ALLOC_ARR(relation_posting_t *, r->arity)) == NULL)
+            return ENOMEM;
+        if ((r->indexpos = ALLOC_ARR(int *, r->arity)) == NULL) {
+            index_free(r);
+            return ENOMEM;
+        }
+    }
+
+    if ((pos = ALLOC_ARR(int, r->nslot + 1)) == NULL)
+        return ENOMEM;
+
+    if (index_grow(r) ||
+        (p = ALLOC_ARR(relation_posting_t, r->nindex)) == NULL) {
+        FREE(pos);
+        return ENOMEM;
+    }
+    r->index[column]    = p;
+    r->indexpos[column] = pos;
+
+    for (slot = 0; slot < r->nrelation; slot++) {
+        id = r->relations[slot][column];
+        if (posting_add(p + id, slot)) {
+            index_free(r);
+            return ENOMEM;
+        }
+        pos[slot] = p[id].nslot - 1;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * index_free
+ ********************/
+static void
+index_free(relation_t *r)
+{
+    int c, i;
+
+    if (r->index == NULL)
+        return;
+
+    for (c = 0; c < r->arity; c++) {
+        if (r->indexpos != NULL)
+            FREE(r->indexpos[c]);
+        if (r->index[c] == NULL)
+            continue;
+        for (i = 0; i < r->nindex; i++)
+            FREE(r->index[c][i].slots);
+        FREE(r->index[c]);
+    }
+
+    FREE(r->index);
+    FREE(r->indexpos);
+    r->index    = NULL;
+    r->indexpos = NULL;
+    r->nindex   = 0;
+}
+
+
+/*
+ * Notes:
+ *     Besides the tuples themselves we keep a copy of each column in a
+ *     contiguous array of item ids. Scans that cannot use the tuple hash
+ *     (partial matches, selections) walk these instead of the tuples,
+ *     which avoids chasing a pointer per tuple and lets us compare four
+ *     or eight ids at a time when SIMD is available.
+ */
+
+
+/********************
+ * column_grow
+ ********************/
+static int
+column_grow(relation_t *r, int nslot)
+{
+    int c;
+
+    if (r->columns == NULL)
+        if ((r->columns = ALLOC_ARR(int32_t *, r->arity)) == NULL)
+            return ENOMEM;
+
+    for (c = 0; c < r->arity; c++) {
+        if (REALLOC_ARR(r->columns[c], r->nslot, nslot) == NULL)
+            return ENOMEM;
+        if (r->indexpos != NULL && r->indexpos[c] != NULL)
+            if (REALLOC_ARR(r->indexpos[c], r->nslot + 1, nslot + 1) == NULL)
+                return ENOMEM;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * column_find
+ ********************/
+static int
+column_find(const int32_t *column, int n, int32_t id, int i)
+{
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32(id);
+    __m256i ids;
+    int     mask;
+
+    for (; i + 8 <= n; i += 8) {
+        ids  = _mm256_loadu_si256((const __m256i *)(column + i));
+        mask = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(ids, key)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(id);
+    __m128i ids;
+    int     mask;
+
+    for (; i + 4 <= n; i += 4) {
+        ids  = _mm_loadu_si128((const __m128i *)(column + i));
+        mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ids, key)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    int32x4_t  key = vdupq_n_s32(id);
+    uint32x4_t eq;
+    uint32x2_t any;
+
+    for (; i + 4 <= n; i += 4) {
+        eq  = vceqq_s32(vld1q_s32(column + i), key);
+        any = vorr_u32(vget_low_u32(eq), vget_high_u32(eq));
+        if (vget_lane_u32(vpmax_u32(any, any), 0))
+            break;                          /* let the loop below locate it */
+    }
+#endif
+
+    for (; i < n; i++)
+        if (column[i] == id)
+            return i;
+
+    return -1;
+}
+
+
+/********************
+ * column_scan
+ ********************/
+static int
+column_scan(relation_t *r, int *ids, int slot)
+{
+    int c, i;
+
+    /*
+     * Find the first tuple from slot on matching ids (-1 matches any item).
+     * The first bound column drives the vectorized scan, the rest of the
+     * bound columns are checked only for the candidates it produces.
+     */
+
+    for (c = 0; c < r->arity && ids[c] < 0; c++)
+        ;
+
+    if (c == r->arity)
+        return slot < r->nrelation ? slot : -1;
+
+    while ((slot = column_find(r->columns[c], r->nrelation,
+                               ids[c], slot)) >= 0) {
+        for (i = c + 1; i < r->arity; i++)
+            if (ids[i] >= 0 && r->columns[i][slot] != ids[i])
+                break;
+        if (i == r->arity)
+            return slot;
+        slot++;
+    }
+
+    return -1;
+}
+
+
+#ifdef __TEST__
+
+static int nrefresh;
+
+static int
+test_refresh(relation_t *r, void *data)
+{
+    nrefresh++;
+    return relation_insert(r, (char **)data);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+#define fatal(ec, fmt, args...) do {              \
+        printf("fatal error: "fmt".\n", ## args); \
+        exit(ec);                                 \
+    } while (0)
+    
+
+    char *chair[]  = { "chair" , "room"       , "floor" };
+    char *laptop[] = { "laptop", "room"       , "table" };
+    char *iriver[] = { "iriver", "study"      , "mousepad" };
+    char *tv[]     = { "TV"    , "living room", "TV-stand" };
+    char *htpc[]   = { "HTPC"  , "TV-stand"   , "bottom"   };
+    char *fridge[] = { "fridge", "kitched"    , "floor"    };
+    char *micro[]  = { "micro" , "cupbord"    , "bottom"   };
+    char *bed[]    = { "bed"   , "bedroom"    , "floor"    };
+    char *pizza[]  = { "pizza" , "fridge"     , "shelf"    };
+    char *tub[]    = { "tub"   , "bathroom"   , "floor"    };
+
+    char **initial_items[] = { chair, laptop, iriver, NULL };
+    char **more_items[]    = { tv, htpc, fridge, micro, bed, pizza, tub, NULL };
+    char ***items;
+
+    relation_t *test;
+    int         j, i;
+
+
+#define check() do {                                                          \
+        for (items = initial_items, j = 0; items[j]; j++)                     \
+            printf("  chk: (%s,%s,%s): %s\n",                                 \
+                   items[j][0], items[j][1], items[j][2],                     \
+                   relation_member(test, items[j]) ?  "yes" : "no");          \
+        for (items = more_items, j = 0; items[j]; j++)                        \
+            printf("  chk: (%s,%s,%s): %s\n",                                 \
+                   items[j][0], items[j][1], items[j][2],                     \
+                   relation_member(test, items[j]) ? "yes" : "no");           \
+    } while (0)
+
+
+    if ((test = relation_create("in,on_top_of", 3, initial_items)) == NULL)
+        fatal(1, "failed to create relation");
+    
+    for (i = 0; more_items[i]; i++) {
+        if (relation_insert(test, more_items[i]))
+            fatal(2, "failed to insert items");
+        printf("inserted (%s, %s, %s)\n",
+               more_items[i][0], more_items[i][1], more_items[i][2]);
+        relation_dump(test);
+        check();
+    }
+
+    for (i = 0; initial_items[i]; i++) {
+        if (relation_delete(test, initial_items[i]))
+            fatal(2, "failed to delete items");
+        printf("deleted (%s, %s, %s)\n",
+               initial_items[i][0], initial_items[i][1], initial_items[i][2]);
+        relation_dump(test);
+        check();
+    }
+
+    for (i = 0; more_items[i]; i++) {
+        if (relation_delete(test, more_items[i]))
+            fatal(2, "failed to delete items");
+        printf("deleted (%s, %s, %s)\n",
+               more_items[i][0], more_items[i][1], more_items[i][2]);
+        relation_dump(test);
+        check();
+    }
+
+    {
+        char  a[16], b[16], c[16], *big[] = { a, b, c };
+        int   n = 10000, nid = 0;
+
+        for (i = 0; i < n; i++) {
+            snprintf(a, sizeof(a), "a%d", i % 97);
+            snprintf(b, sizeof(b), "b%d", i);
+            snprintf(c, sizeof(c), "c%d", i % 13);
+            if (relation_insert(test, big) || relation_insert(test, big))
+                fatal(3, "failed to insert item #%d", i);
+        }
+        if (test->nrelation != n)
+            fatal(3, "expected %d tuples, got %d", n, test->nrelation);
+
+        for (i = 0; i < n; i += 2) {
+            snprintf(a, sizeof(a), "a%d", i % 97);
+            snprintf(b, sizeof(b), "b%d", i);
+            snprintf(c, sizeof(c), "c%d", i % 13);
+            if (relation_delete(test, big))
+                fatal(3, "failed to delete item #%d", i);
+        }
+
+        for (i = 0; i < n; i++) {
+            snprintf(a, sizeof(a), "a%d", i % 97);
+            snprintf(b, sizeof(b), "b%d", i);
+            snprintf(c, sizeof(c), "c%d", i % 13);
+            if (relation_member(test, big) != (i & 1))
+                fatal(3, "membership of item #%d is wrong", i);
+        }
+        printf("%d tuples, %d items ok\n", test->nrelation, test->nitem);
+
+        {
+            int *slots, nslot, id, k;
+
+            if ((id = relation_item(test, "a5")) < 0)
+                fatal(4, "failed to look up item a5");
+            nslot = relation_postings(test, 0, id, &slots);
+            for (k = 0; k < nslot; k++)
+                if (test->relations[slots[k]][0] != id)
+                    fatal(4, "tuple %d does not match a5", slots[k]);
+
+            for (i = 1; i < n; i += 4) {
+                snprintf(a, sizeof(a), "a%d", i % 97);
+                snprintf(b, sizeof(b), "b%d", i);
+                snprintf(c, sizeof(c), "c%d", i % 13);
+                if (relation_delete(test, big))
+                    fatal(4, "failed to delete item #%d", i);
+            }
+
+            for (k = 0; k < test->nitem; k++) {
+                if (strncmp(test->items[k], "a", 1))
+                    continue;
+                nslot = relation_postings(test, 0, k, &slots);
+                for (i = 0; i < nslot; i++)
+                    if (test->relations[slots[i]][0] != k)
+                        fatal(4, "stale posting for %s", test->items[k]);
+                nid += nslot;
+            }
+            if (nid != test->nrelation)
+                fatal(4, "%d postings for %d tuples", nid, test->nrelation);
+            printf("%d postings ok\n", nid);
+
+            for (i = 0; i < 100; i++) {
+                snprintf(a, sizeof(a), "new%d", i);
+                snprintf(b, sizeof(b), "b%d", i);
+                snprintf(c, sizeof(c), "c%d", i);
+                if (relation_insert(test, big))
+                    fatal(4, "failed to insert item #%d", i);
+                if ((id = relation_item(test, a)) < 0 ||
+                    relation_postings(test, 0, id, &slots) != 1 ||
+                    test->relations[slots[0]][0] != id)
+                    fatal(4, "no posting for new item %s", a);
+            }
+        }
+
+        {
+            char *any[] = { NULL, NULL, "c7" };
+            int   slots[16], nslot, k;
+
+            nslot = relation_select(test, any, slots, 16);
+            for (i = 0, k = 0; i < test->nrelation; i++)
+                if (!strcmp(test->items[test->relations[i][2]], "c7"))
+                    k++;
+            if (nslot != k)
+                fatal(6, "selected %d tuples instead of %d", nslot, k);
+            for (i = 0; i < nslot && i < 16; i++)
+                if (strcmp(test->items[test->relations[slots[i]][2]], "c7"))
+                    fatal(6, "selected tuple %d does not match", slots[i]);
+
+            any[0] = "a3";
+            any[2] = NULL;
+            while (relation_select(test, any, slots, 1) > 0)
+                if (relation_delete(test, any))
+                    fatal(6, "failed to delete (a3, ...)");
+            if (relation_delete(test, any) != ENOENT)
+                fatal(6, "deleted nonexistent (a3, ...)");
+            for (i = 0; i < test->nrelation; i++)
+                for (k = 0; k < test->arity; k++)
+                    if (test->columns[k][i] != test->relations[i][k])
+                        fatal(6, "column %d of tuple %d is stale", k, i);
+            printf("%d selected tuples ok\n", nslot);
+        }
+    }
+
+    {
+        relation_t *rs[256];
+        char        name[32];
+        int         handles[256];
+
+        for (i = 0; i < 256; i++) {
+            snprintf(name, sizeof(name), "relation-%d", i);
+            if ((rs[i] = relation_create(name, 2, NULL)) == NULL)
+                fatal(5, "failed to create relation %s", name);
+            handles[i] = rs[i]->handle;
+        }
+        if (relation_create("relation-7", 2, NULL) != NULL)
+            fatal(5, "created duplicate relation relation-7");
+
+        for (i = 0; i < 256; i += 2)
+            relation_destroy(rs[i]);
+
+        for (i = 0; i < 256; i++) {
+            snprintf(name, sizeof(name), "relation-%d", i);
+            if (relation_lookup(name) != (i & 1 ? rs[i] : NULL) ||
+                relation_find(handles[i]) != (i & 1 ? rs[i] : NULL))
+                fatal(5, "lookup of relation %s failed", name);
+        }
+
+        for (i = 0; i < 256; i += 2) {
+            snprintf(name, sizeof(name), "relation-%d", i);
+            if ((rs[i] = relation_create(name, 2, NULL)) == NULL ||
+                relation_find(handles[i]) != NULL ||
+                relation_find(rs[i]->handle) != rs[i])
+                fatal(5, "stale handle for relation %s", name);
+        }
+
+        for (i = 0; i < 256; i++)
+            relation_destroy(rs[i]);
+        printf("relation registry ok\n");
+    }
+
+    {
+        relation_t *r1, *r2;
+        char       *t1[] = { "shared", "one" }, *t2[] = { "shared", "two" };
+        item_t      item;
+
+        if ((r1 = relation_create("interned-1", 2, NULL)) == NULL ||
+            (r2 = relation_create("interned-2", 2, NULL)) == NULL ||
+            relation_insert(r1, t1) || relation_insert(r2, t2))
+            fatal(7, "failed to create interned relations");
+
+        if ((item = item_find("shared")) == NULL ||
+            r1->items[relation_item(r1, "shared")] != item ||
+            r2->items[relation_item(r2, "shared")] != item)
+            fatal(7, "item \"shared\" is not shared");
+
+        relation_destroy(r1);
+        if (item_find("one") != NULL || item_find("shared") != item)
+            fatal(7, "wrong reference counts after destroying a relation");
+        relation_destroy(r2);
+        if (item_find("shared") != NULL)
+            fatal(7, "item \"shared\" leaked");
+        printf("interned items ok\n");
+    }
+
+    {
+        relation_t          *r;
+        relation_snapshot_t *s1, *s2, *s3;
+        char                 x[16], y[16], *t[] = { x, y };
+        int                  k;
+
+#define SNAPSHOT_OK(s, n) do {                                           \
+            if ((s)->nrelation != (n))                                   \
+                fatal(11, "snapshot has %d tuples instead of %d",        \
+                      (s)->nrelation, (n));                              \
+            for (k = 0; k < (s)->nrelation; k++) {                       \
+                snprintf(x, sizeof(x), "x%d", k);                        \
+                if (strcmp((s)->items[(s)->relations[k][0]], x))         \
+                    fatal(11, "snapshot tuple #%d has changed", k);      \
+            }                                                            \
+        } while (0)
+
+        if ((r = relation_create("snapshot", 2, NULL)) == NULL)
+            fatal(11, "failed to create relation");
+        for (i = 0; i < 100; i++) {
+            snprintf(x, sizeof(x), "x%d", i);
+            snprintf(y, sizeof(y), "y%d", i);
+            if (relation_insert(r, t))
+                fatal(11, "failed to insert tuple #%d", i);
+        }
+
+        if ((s1 = relation_snapshot(r)) == NULL ||
+            (s2 = relation_snapshot(r)) != s1)
+            fatal(11, "failed to share snapshot");
+
+        for (i = 0; i < 100; i += 3) {
+            snprintf(x, sizeof(x), "x%d", i);
+            snprintf(y, sizeof(y), "y%d", i);
+            if (relation_delete(r, t))
+                fatal(11, "failed to delete tuple #%d", i);
+        }
+        if ((s3 = relation_snapshot(r)) == NULL || s3 == s1 ||
+            s3->nrelation != r->nrelation)
+            fatal(11, "failed to take new snapshot");
+
+        relation_reset(r);
+        SNAPSHOT_OK(s1, 100);
+        relation_release(s1);
+        SNAPSHOT_OK(s2, 100);
+        relation_release(s2);
+
+        for (i = 0; i < 10; i++) {
+            snprintf(x, sizeof(x), "new%d", i);
+            if (relation_insert(r, t))
+                fatal(11, "failed to insert tuple #%d", i);
+        }
+        relation_destroy(r);
+
+        for (k = 0; k < s3->nrelation; k++)
+            if (strncmp(s3->items[s3->relations[k][0]], "x", 1) ||
+                atoi(s3->items[s3->relations[k][0]] + 1) % 3 == 0)
+                fatal(11, "snapshot tuple #%d has changed", k);
+        relation_release(s3);
+        if (item_find("x1") != NULL)
+            fatal(11, "items of released snapshot leaked");
+        printf("relation snapshots ok\n");
+#undef SNAPSHOT_OK
+    }
+
+    {
+        relation_t          *r;
+        relation_snapshot_t *s0, *s;
+        char                 x[16], y[16], *t[] = { x, y }, *q[] = { x, NULL };
+        int                **rows, ncopy, k;
+
+        /* queries interleaved with inserts should not copy the relation */
+        if ((r = relation_create("cow", 2, NULL)) == NULL)
+            fatal(12, "failed to create relation");
+        for (i = 0; i < 10; i++) {
+            snprintf(x, sizeof(x), "x%d", i);
+            snprintf(y, sizeof(y), "y%d", i);
+            if (relation_insert(r, t))
+                fatal(12, "failed to insert tuple #%d", i);
+        }
+        if ((s0 = relation_snapshot(r)) == NULL)
+            fatal(12, "failed to take snapshot");
+
+        rows  = r->relations;
+        ncopy = 0;
+        for (i = 10; i < 1000; i++) {
+            snprintf(x, sizeof(x), "x%d", i);
+            snprintf(y, sizeof(y), "y%d", i);
+            if (relation_insert(r, t))
+                fatal(12, "failed to insert tuple #%d", i);
+            if ((s = relation_snapshot(r)) == NULL)
+                fatal(12, "failed to take snapshot #%d", i);
+            if (s->relations != r->relations || s->items != r->items ||
+                s->nrelation != i + 1)
+                fatal(12, "snapshot #%d is not shared", i);
+            if (relation_select(r, q, NULL, 0) != 1)
+                fatal(12, "failed to find tuple #%d", i);
+            relation_release(s);
+            if (r->relations != rows) {
+                rows = r->relations;
+                ncopy++;
+            }
+        }
+        if (ncopy > 10)                      /* only when the rows grow */
+            fatal(12, "tuples copied %d times for 990 inserts", ncopy);
+
+        for (k = 0; k < s0->nrelation; k++) {
+            snprintf(x, sizeof(x), "x%d", k);
+            if (strcmp(s0->items[s0->relations[k][0]], x))
+                fatal(12, "snapshot tuple #%d has changed", k);
+        }
+
+        /* a delete moves tuples around, so it unshares them once */
+        if ((s = relation_snapshot(r)) == NULL)
+            fatal(12, "failed to take snapshot");
+        snprintf(x, sizeof(x), "x0");
+        snprintf(y, sizeof(y), "y0");
+        if (relation_delete(r, t) || s->relations == r->relations)
+            fatal(12, "failed to unshare tuples on delete");
+        rows = r->relations;
+        snprintf(x, sizeof(x), "x1");
+        snprintf(y, sizeof(y), "y1");
+        if (relation_delete(r, t) || r->relations != rows)
+            fatal(12, "unshared tuples copied again");
+        if (s->nrelation != 1000 || strcmp(s->items[s->relations[0][0]], "x0"))
+            fatal(12, "snapshot changed by delete");
+
+        relation_release(s);
+        relation_release(s0);
+        relation_destroy(r);
+        printf("copy-on-write snapshots ok\n");
+    }
+
+    {
+        relation_t      *dc, *cr;
+        relation_pair_t *pairs;
+        char             d[16], k[16], o[16], *t[] = { d, k, o };
+        int              npair, nloop, l, m;
+
+        if ((dc = relation_create("device-class", 2, NULL)) == NULL ||
+            (cr = relation_create("class-route", 3, NULL)) == NULL)
+            fatal(10, "failed to create join relations");
+
+        for (i = 0; i < 1000; i++) {
+            snprintf(d, sizeof(d), "device%d", i);
+            snprintf(k, sizeof(k), "class%d", i % 37);
+            if (relation_insert(dc, t))
+                fatal(10, "failed to insert into device-class");
+        }
+        for (i = 0; i < 500; i++) {
+            snprintf(d, sizeof(d), "class%d", i % 53);
+            snprintf(k, sizeof(k), "route%d", i);
+            snprintf(o, sizeof(o), "prio%d", i % 3);
+            if (relation_insert(cr, t))
+                fatal(10, "failed to insert into class-route");
+        }
+
+        if ((npair = relation_join(dc, 1, cr, 0, &pairs)) < 0)
+            fatal(10, "join failed (%d)", -npair);
+
+        for (l = 0, nloop = 0; l < dc->nrelation; l++)
+            for (m = 0; m < cr->nrelation; m++)
+                if (dc->items[dc->relations[l][1]] ==
+                    cr->items[cr->relations[m][0]])
+                    nloop++;
+        if (npair != nloop)
+            fatal(10, "join gave %d pairs instead of %d", npair, nloop);
+
+        for (i = 0; i < npair; i++)
+            if (dc->items[dc->relations[pairs[i].left][1]] !=
+                cr->items[cr->relations[pairs[i].right][0]])
+                fatal(10, "pair %d does not match", i);
+
+        free(pairs);
+        relation_destroy(dc);
+        relation_destroy(cr);
+        printf("%d joined pairs ok\n", npair);
+    }
+
+    {
+        relation_t *bulk;
+        char      **tuples[2 * 10000 + 1], *buf, *t, *u[] = { "x7", "y7" };
+        int        *slots, n = 10000, id;
+
+        if ((buf = malloc(n * 2 * 16)) == NULL)
+            fatal(8, "failed to allocate test tuples");
+        for (i = 0; i < 2 * n; i++) {
+            t = buf + (i % n) * 32;
+            snprintf(t, 16, "x%d", i % n);
+            snprintf(t + 16, 16, "y%d", (i % n) % 101);
+            if ((tuples[i] = malloc(2 * sizeof(char *))) == NULL)
+                fatal(8, "failed to allocate test tuples");
+            tuples[i][0] = t;
+            tuples[i][1] = t + 16;
+        }
+        tuples[2 * n] = NULL;
+
+        if ((bulk = relation_create("bulk", 2, NULL)) == NULL ||
+            relation_insert(bulk, u) ||
+            (id = relation_item(bulk, "y7")) < 0 ||
+            relation_postings(bulk, 1, id, &slots) != 1)
+            fatal(8, "failed to create bulk relation");
+
+        if (relation_insert_many(bulk, tuples))
+            fatal(8, "failed to bulk insert tuples");
+        if (bulk->nrelation != n)
+            fatal(8, "expected %d tuples, got %d", n, bulk->nrelation);
+        if (relation_postings(bulk, 1, id, &slots) != (n - 1 - 7) / 101 + 1)
+            fatal(8, "stale index after bulk insert");
+        for (i = 0; i < 2 * n; i++)
+            if (!relation_member(bulk, tuples[i]))
+                fatal(8, "tuple #%d is missing", i);
+        for (i = 0; i < bulk->nrelation; i++)
+            if (bulk->columns[1][i] != bulk->relations[i][1])
+                fatal(8, "column of tuple %d is stale", i);
+
+        {
+            relation_t *mapped;
+            char       *path = "/tmp/relation-test.map";
+            char       *any[] = { NULL, "y7" };
+            int         k;
+
+            if (relation_save(bulk, path) ||
+                (mapped = relation_map("mapped", path)) == NULL)
+                fatal(9, "failed to save and map relation");
+            if (mapped->nrelation != bulk->nrelation ||
+                mapped->nitem != bulk->nitem)
+                fatal(9, "mapped relation has wrong size");
+            for (i = 0; i < 2 * n; i++)
+                if (!relation_member(mapped, tuples[i]))
+                    fatal(9, "tuple #%d is missing from mapping", i);
+            k = relation_select(mapped, any, NULL, 0);
+            if (k != relation_select(bulk, any, NULL, 0) ||
+                (id = relation_item(mapped, "y7")) < 0 ||
+                relation_postings(mapped, 1, id, &slots) != k)
+                fatal(9, "mapped relation gives wrong selection");
+            if (relation_insert(mapped, u) != EROFS ||
+                relation_delete(mapped, u) != EROFS)
+                fatal(9, "mapped relation is not read-only");
+            if (relation_lookup("mapped") != mapped)
+                fatal(9, "mapped relation is not registered");
+
+            relation_destroy(mapped);
+            if (relation_map(NULL, path) != NULL)
+                fatal(9, "mapped duplicate relation \"bulk\"");
+            if (truncate(path, 4096) != 0 || relation_map("x", path) != NULL)
+                fatal(9, "mapped truncated relation");
+            unlink(path);
+            printf("mapped relation ok\n");
+        }
+
+        relation_destroy(bulk);
+        for (i = 0; i < 2 * n; i++)
+            free(tuples[i]);
+        free(buf);
+        printf("bulk insert ok\n");
+    }
+
+    {
+        relation_t  *typed;
+        item_type_t  types[] = { ITEM_STRING, ITEM_INT, ITEM_DOUBLE };
+        char        *good[]  = { "x", "42", "0.5" };
+        char        *whole[] = { "y", "-7", "3" };
+        char        *bad1[]  = { "x", "4.2", "1" };
+        char        *bad2[]  = { "x", "042", "1" };
+        char        *bad3[]  = { "x", "1", "abc" };
+        item_t       item;
+
+        if ((typed = relation_create("typed", 3, NULL)) == NULL)
+            fatal(10, "failed to create typed relation");
+        if (relation_set_types(typed, types) ||
+            relation_set_types(typed, types) != EBUSY)
+            fatal(10, "failed to set column types");
+        if (relation_insert(typed, good) || relation_insert(typed, whole))
+            fatal(10, "failed to insert typed tuples");
+        if (relation_insert(typed, bad1) != EINVAL ||
+            relation_insert(typed, bad2) != EINVAL ||
+            relation_insert(typed, bad3) != EINVAL || typed->nrelation != 2)
+            fatal(10, "inserted ill-typed tuples");
+        if (typed->nitem != 6 || item_find("4.2") || item_find("abc"))
+            fatal(10, "ill-typed tuples left items behind");
+
+        item = typed->items[typed->relations[0][1]];
+        if (item_type(item) != ITEM_INT || item_int(item) != 42)
+            fatal(10, "wrong integer value for %s", item);
+        item = typed->items[typed->relations[0][2]];
+        if (item_type(item) != ITEM_DOUBLE || item_double(item) != 0.5)
+            fatal(10, "wrong floating point value for %s", item);
+        if (item_find_double(3.0) != typed->items[typed->relations[1][2]] ||
+            item_find_int(-7) != typed->items[typed->relations[1][1]])
+            fatal(10, "numbers do not map to their items");
+        if ((item = item_intern_double(0.1)) == NULL || strcmp(item, "0.1"))
+            fatal(10, "non-canonical floating point item %s", item);
+        item_unref(item);
+
+        relation_destroy(typed);
+        printf("typed columns ok\n");
+    }
+
+    {
+        relation_t          *lazy;
+        relation_snapshot_t *s;
+        char                *pending[] = { "a", "b" };
+
+        if ((lazy = relation_create("lazy", 2, NULL)) == NULL)
+            fatal(11, "failed to create lazy relation");
+        relation_invalidate(lazy);              /* no callback, no effect */
+        if (lazy->stale)
+            fatal(11, "relation without refresh callback is stale");
+
+        relation_set_refresh(lazy, test_refresh, pending);
+        relation_invalidate(lazy);
+        if (lazy->nrelation != 0 || nrefresh != 0)
+            fatal(11, "relation refreshed before read");
+        if (!relation_member(lazy, pending) || nrefresh != 1)
+            fatal(11, "stale relation not refreshed on read");
+        if ((s = relation_snapshot(lazy)) == NULL || nrefresh != 1)
+            fatal(11, "fresh relation refreshed again");
+        relation_release(s);
+
+        relation_destroy(lazy);
+        printf("lazy refresh ok\n");
+    }
+
+    relation_reset(test);
+    relation_destroy(test);
+    
+    return 0;
+}
+
+
+#endif /* __TEST__ */
+
+
+#ifdef __BENCH__
+
+#include <time.h>
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+    relation_t *r;
+    char        a[16], b[16], c[16], *items[] = { a, b, c };
+    char       *any[] = { NULL, NULL, NULL };
+    int         n, nquery, q, i, slot, id, nrow, ncol;
+    double      t, trow, tcol;
+
+    n      = argc > 1 ? atoi(argv[1]) : 100000;
+    nquery = argc > 2 ? atoi(argv[2]) : 1000;
+
+    if ((r = relation_create("bench", 3, NULL)) == NULL)
+        return 1;
+
+    for (i = 0; i < n; i++) {
+        snprintf(a, sizeof(a), "a%d", i);
+        snprintf(b, sizeof(b), "b%d", i % 1013);
+        snprintf(c, sizeof(c), "c%d", i % 7);
+        if (relation_insert(r, items))
+            return 1;
+    }
+
+    /*
+     * Select tuples by their second column both by walking the tuples
+     * like we used to and by scanning the columns. Every query visits
+     * the whole relation.
+     */
+
+    nrow = ncol = 0;
+    trow = tcol = 0;
+
+    for (q = 0; q < nquery; q++) {
+        snprintf(b, sizeof(b), "b%d", (q * 7919) % 1013);
+        id = relation_item(r, b);
+
+        t = now();
+        for (slot = 0; slot < r->nrelation; slot++)
+            if (r->relations[slot][1] == id)
+                nrow++;
+        trow += now() - t;
+
+        any[1] = b;
+        t = now();
+        ncol += relation_select(r, any, NULL, 0);
+        tcol += now() - t;
+    }
+
+    if (nrow != ncol) {
+        printf("row scan found %d, column scan %d tuples\n", nrow, ncol);
+        return 1;
+    }
+
+    printf("%d tuples, %d queries, %d matches\n", n, nquery, nrow);
+    printf("row layout:    %8.3f ms, %6.3f ns/tuple\n",
+           trow / 1e6, trow / ((double)n * nquery));
+    printf("column layout: %8.3f ms, %6.3f ns/tuple (%.2fx)\n",
+           tcol / 1e6, tcol / ((double)n * nquery), trow / tcol);
+
+    relation_destroy(r);
+
+    return 0;
+}
+
+#endif /* __BENCH__ */
 
 
 
@@ -25,12 +25,15 @@ USA.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include <prolog/list.h>
 #include <prolog/set.h>
 
 
-static LIST_HOOK(sets);
+#define CHUNK 8
+
+static registry_t sets = REGISTRY_INIT(set_t);
 
 
 /********************
@@ -40,7 +43,6 @@ set_t *
 set_create(char *name, char **initial_items)
 {
     set_t *set;
-    int    i;
 
     if (set_lookup(name) != NULL)
         return NULL;
@@ -49,23 +51,26 @@ set_create(char *name, char **initial_items)
         goto fail;
     memset(set, 0, sizeof(*set));
 
-    list_hook_init(&set->hook);
-
     if ((set->name = strdup(name)) == NULL)
         goto fail;
     
     if (initial_items != NULL)
-        for (i = 0; initial_items[i]; i++)
-            if (set_insert(set, initial_items[i]))
-                goto fail;
+        if (set_insert_many(set, initial_items))
+            goto fail;
+
+    if (registry_add(&sets, set))
+        goto fail;
 
-    list_add_tail(&set->hook, &sets);
     return set;
     
  fail:
     if (set) {
         if (set->name)
             free(set->name);
+        if (set->items) {
+            set_reset(set);
+            free(set->items);
+        }
         
         free(set);
     }
@@ -82,7 +87,7 @@ set_destroy(set_t *set)
     if (set == NULL)
         return;
     
-    list_delete(&set->hook);
+    registry_del(&sets, set);
 
     if (set->name)
         free(set->name);
@@ -101,16 +106,191 @@ set_destroy(set_t *set)
 set_t *
 set_lookup(char *name)
 {
-    list_hook_t *p;
-    set_t       *set;
+    return registry_lookup(&sets, name);
+}
+
+
+/********************
+ * set_find
+ ********************/
+set_t *
+set_find(int handle)
+{
+    return registry_find(&sets, handle);
+}
+
+
+/*
+ * Notes:
+ *     Besides the array of items every set hashes its items using open
+ *     addressing, each bucket holding the slot of the item plus one.
+ *     Sets with items from a dense range of interned indices also keep a
+ *     bitmap of the item indices for fast membership tests and set
+ *     algebra, while the hash still finds the slot of an item to delete.
+ *     The bitmap is picked whenever a set is (re)built in bulk and it is
+ *     dropped once it would become too sparse.
+ */
+
+#define BITS       64
+#define WORD(i)    ((i) / BITS)
+#define BIT(i)     ((uint64_t)1 << ((i) % BITS))
+#define DENSE(n, w) ((w) <= (n) / 2 + 1)    /* at most ~128 bits per item */
+
+
+/********************
+ * item_hash
+ ********************/
+static unsigned int
+item_hash(item_t item)
+{
+    unsigned long h = (unsigned long)item;
+
+    h ^= h >> 4;
+    return (unsigned int)(h * 2654435761U) ^ (unsigned int)(h >> 16);
+}
+
+
+/********************
+ * hash_find
+ ********************/
+static int
+hash_find(set_t *set, item_t item)
+{
+    unsigned int mask, b;
+
+    if (set->hash == NULL)
+        return -1;
 
-    list_iter_forw(p, &sets) {
-        set = list_entry(p, set_t, hook);
-        if (!strcmp(set->name, name))
-            return set;
+    mask = set->nhash - 1;
+    for (b = item_hash(item) & mask; set->hash[b]; b = (b + 1) & mask)
+        if (set->items[set->hash[b] - 1] == item)
+            return b;
+
+    return -1;
+}
+
+
+/********************
+ * hash_add
+ ********************/
+static void
+hash_add(set_t *set, int slot)
+{
+    unsigned int mask, b;
+
+    mask = set->nhash - 1;
+    for (b = item_hash(set->items[slot]) & mask; set->hash[b]; b = (b+1) & mask)
+        ;
+    set->hash[b] = slot + 1;
+}
+
+
+/********************
+ * hash_del
+ ********************/
+static void
+hash_del(set_t *set, unsigned int b)
+{
+    unsigned int mask, n, home;
+
+    mask = set->nhash - 1;
+    for (n = (b + 1) & mask; set->hash[n]; n = (n + 1) & mask) {
+        home = item_hash(set->items[set->hash[n] - 1]) & mask;
+        if (((n - home) & mask) >= ((n - b) & mask)) {
+            set->hash[b] = set->hash[n];
+            b = n;
+        }
     }
+    set->hash[b] = 0;
+}
 
-    return NULL;
+
+/********************
+ * hash_build
+ ********************/
+static int
+hash_build(set_t *set, int nitem)
+{
+    int *hash, size, i;
+
+    for (size = 16; size < 2 * (nitem + 1); size *= 2)
+        ;
+    if ((hash = calloc(size, sizeof(*hash))) == NULL)
+        return ENOMEM;
+
+    free(set->hash);
+    set->hash  = hash;
+    set->nhash = size;
+    for (i = 0; i < set->nitem; i++)
+        hash_add(set, i);
+
+    return 0;
+}
+
+
+/********************
+ * set_rebuild
+ ********************/
+static int
+set_rebuild(set_t *set, int nitem)
+{
+    uint64_t *bits;
+    int       nword, i, idx;
+
+    /*
+     * Rebuild the lookup structures of set for nitem items, adding
+     * a bitmap to the hash if the item indices are dense enough.
+     */
+
+    for (i = 0, nword = 0; i < set->nitem; i++)
+        if ((idx = item_index(set->items[i])) >= nword * BITS)
+            nword = WORD(idx) + 1;
+
+    free(set->bits);
+    free(set->hash);
+    set->bits  = NULL;
+    set->nword = 0;
+    set->hash  = NULL;
+    set->nhash = 0;
+
+    if (set->nitem > 0 && DENSE(nitem, nword)) {
+        if ((bits = calloc(nword, sizeof(*bits))) == NULL)
+            return ENOMEM;
+        for (i = 0; i < set->nitem; i++) {
+            idx = item_index(set->items[i]);
+            bits[WORD(idx)] |= BIT(idx);
+        }
+        set->bits  = bits;
+        set->nword = nword;
+    }
+
+    return hash_build(set, nitem);
+}
+
+
+/********************
+ * set_grow
+ ********************/
+static int
+set_grow(set_t *set, int nitem)
+{
+    item_t *p;
+    int     nslot;
+
+    if (nitem <= set->nslot)
+        return 0;
+
+    for (nslot = set->nslot ? set->nslot : CHUNK; nslot < nitem; nslot *= 2)
+        ;
+
+    if ((p = realloc(set->items, nslot * sizeof(*p))) == NULL)
+        return ENOMEM;
+    memset(p + set->nslot, 0, (nslot - set->nslot) * sizeof(*p));
+
+    set->items = p;
+    set->nslot = nslot;
+
+    return 0;
 }
 
 
@@ -118,59 +298,180 @@ set_lookup(char *name)
  * set_insert
  ********************/
 int
-set_insert(set_t *set, char *item)
+set_insert(set_t *set, char *name)
 {
-#define CHUNK 8
-    char **p;
+    item_t    item;
+    uint64_t *bits;
+    int       idx, nword;
 
-    if (set_member(set, item))
+    if (set_member(set, name))
         return 0;                                  /* hmm... EEXIST ? */
     
-    if (set->items == NULL) {
-        if ((set->items = malloc(CHUNK * sizeof(*set->items))) == NULL)
-            return ENOMEM;
-        memset(set->items, 0, CHUNK * sizeof(*set->items));
-        set->nslot = CHUNK;
-        set->nitem = 0;
+    if (set_grow(set, set->nitem + 1))
+        return ENOMEM;
+
+    if ((item = item_intern(name)) == NULL)
+        return ENOMEM;
+
+    set->items[set->nitem++] = item;
+    idx = item_index(item);
+
+    if (set->hash == NULL || 2 * (set->nitem + 1) > set->nhash)
+        goto rebuild;
+
+    hash_add(set, set->nitem - 1);
+
+    if (set->bits == NULL)
+        return 0;
+
+    if (idx < set->nword * BITS) {
+        set->bits[WORD(idx)] |= BIT(idx);
+        return 0;
     }
-    else if (set->nitem >= set->nslot) {
-        if ((p = realloc(set->items, (set->nslot+CHUNK) * sizeof(*p))) == NULL)
-            return ENOMEM;
-        memset(p + set->nslot, 0, CHUNK * sizeof(*p));
-        set->nslot += CHUNK;
-        set->items  = p;
+    nword = WORD(idx) + 1;
+    if (DENSE(set->nitem, nword)) {
+        if ((bits = realloc(set->bits, nword * sizeof(*bits))) == NULL)
+            goto fail;
+        memset(bits + set->nword, 0, (nword - set->nword) * sizeof(*bits));
+        bits[WORD(idx)] |= BIT(idx);
+        set->bits  = bits;
+        set->nword = nword;
+        return 0;
     }
-    
-    if ((set->items[set->nitem] = strdup(item)) == NULL)
-        return ENOMEM;
 
-    set->nitem++;
+ rebuild:
+    /* first item, hash full or too sparse for a bitmap: rebuild */
+    if (set_rebuild(set, 2 * set->nitem))
+        goto fail;
+
     return 0;
+
+ fail:
+    set->nitem--;
+    item_unref(item);
+    set_rebuild(set, set->nitem);
+    return ENOMEM;
 }
 
 
 /********************
- * set_delete
+ * item_cmp
+ ********************/
+typedef struct {
+    item_t item;
+    int    slot;
+} sorted_t;
+
+static int
+item_cmp(const void *p1, const void *p2)
+{
+    const sorted_t *s1 = p1, *s2 = p2;
+
+    if (s1->item != s2->item)
+        return s1->item < s2->item ? -1 : 1;
+    else
+        return s1->slot - s2->slot;
+}
+
+
+/********************
+ * set_insert_many
  ********************/
 int
-set_delete(set_t *set, char *item)
+set_insert_many(set_t *set, char **items)
 {
-    int slot;
+    sorted_t *sorted;
+    int       n, total, i, j;
 
-    for (slot = 0; slot < set->nitem; slot++) {
-        if (set->items[slot] && !strcmp(set->items[slot], item)) {
-            free(set->items[slot]);
-            set->items[slot] = NULL;
-            break;
+    /*
+     * Insert a NULL-terminated array of items. We size the set once,
+     * intern the new items and then sort all items by identity to spot
+     * the duplicates, keeping the first occurence of each item. Finally
+     * we rebuild the lookup structure of the set.
+     */
+
+    for (n = 0; items[n] != NULL; n++)
+        ;
+
+    if (n == 0)
+        return 0;
+
+    total = set->nitem + n;
+
+    if (set_grow(set, total))
+        return ENOMEM;
+
+    if ((sorted = malloc(total * sizeof(*sorted))) == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < total; i++) {
+        if (i >= set->nitem) {
+            if ((set->items[i] = item_intern(items[i - set->nitem])) == NULL) {
+                while (--i >= set->nitem) {
+                    item_unref(set->items[i]);
+                    set->items[i] = NULL;
+                }
+                free(sorted);
+                return ENOMEM;
+            }
         }
+        sorted[i].item = set->items[i];
+        sorted[i].slot = i;
     }
-    
-    if (slot >= set->nitem)
+
+    qsort(sorted, total, sizeof(*sorted), item_cmp);
+
+    for (i = 1; i < total; i++) {
+        if (sorted[i].item == sorted[i - 1].item) {
+            item_unref(set->items[sorted[i].slot]);
+            set->items[sorted[i].slot] = NULL;
+        }
+    }
+
+    free(sorted);
+
+    for (i = j = set->nitem; i < total; i++)
+        if (set->items[i] != NULL)
+            set->items[j++] = set->items[i];
+    for (i = j; i < total; i++)
+        set->items[i] = NULL;
+    set->nitem = j;
+
+    return set_rebuild(set, set->nitem);
+}
+
+
+/********************
+ * set_delete
+ ********************/
+int
+set_delete(set_t *set, char *name)
+{
+    item_t item;
+    int    slot, b, idx;
+
+    if ((item = item_find(name)) == NULL)
         return ENOENT;
-    
+
+    if ((b = hash_find(set, item)) < 0)
+        return ENOENT;
+    slot = set->hash[b] - 1;
+    hash_del(set, b);
+
+    if (set->bits != NULL) {
+        idx = item_index(item);
+        set->bits[WORD(idx)] &= ~BIT(idx);
+    }
+
+    item_unref(set->items[slot]);
     set->nitem--;
-    if (slot != set->nitem)               /* if not last, replace with last */
+
+    if (slot != set->nitem) {             /* if not last, replace with last */
+        b = hash_find(set, set->items[set->nitem]);
+        set->hash[b] = slot + 1;
         set->items[slot] = set->items[set->nitem];
+    }
+    set->items[set->nitem] = NULL;
     
     return 0;
 }
@@ -186,11 +487,35 @@ set_reset(set_t *set)
 
     for (slot = 0; slot < set->nitem; slot++) {
         if (set->items[slot]) {
-            free(set->items[slot]);
+            item_unref(set->items[slot]);
             set->items[slot] = NULL;
         }
     }
     set->nitem = 0;
+
+    free(set->bits);
+    free(set->hash);
+    set->bits  = NULL;
+    set->nword = 0;
+    set->hash  = NULL;
+    set->nhash = 0;
+}
+
+
+/********************
+ * set_has
+ ********************/
+static inline int
+set_has(set_t *set, item_t item)
+{
+    int idx;
+
+    if (set->bits != NULL) {
+        idx = item_index(item);
+        return idx < set->nword * BITS && (set->bits[WORD(idx)] & BIT(idx));
+    }
+    else
+        return hash_find(set, item) >= 0;
 }
 
 
@@ -198,18 +523,343 @@ set_reset(set_t *set)
  * set_member
  ********************/
 int
-set_member(set_t *set, char *item)
+set_member(set_t *set, char *name)
 {
-    int slot;
+    item_t item;
 
-    for (slot = 0; slot < set->nitem; slot++) {
-        if (set->items[slot] && !strcmp(set->items[slot], item))
-            return 1;
+    if ((item = item_find(name)) == NULL)
+        return 0;
+
+    return set_has(set, item);
+}
+
+
+/********************
+ * set_assign
+ ********************/
+static int
+set_assign(set_t *dst, item_t *items, int nitem, uint64_t *bits, int nword)
+{
+    /*
+     * Replace the contents of dst with items (and their bitmap if we have
+     * one). We take over items and bits, including the item references.
+     */
+
+    set_reset(dst);
+    free(dst->items);
+
+    dst->items = items;
+    dst->nitem = nitem;
+    dst->nslot = nitem;
+
+    if (bits != NULL && DENSE(nitem, nword)) {
+        dst->bits  = bits;
+        dst->nword = nword;
+        return hash_build(dst, nitem);
     }
-    
+
+    free(bits);
+    return set_rebuild(dst, nitem);
+}
+
+
+/********************
+ * set_combine
+ ********************/
+enum {
+    SET_UNION = 0,
+    SET_INTERSECTION,
+    SET_DIFFERENCE,
+};
+
+static int
+set_combine(set_t *dst, set_t *a, set_t *b, int op)
+{
+    uint64_t *bits, w;
+    item_t   *items, item;
+    int       nword, nitem, na, nb, i, idx;
+
+    /*
+     * If both sets are bitmaps we combine them a word at a time, in
+     * simple loops that the compiler can vectorize, then collect the
+     * items from the resulting bitmap. Otherwise we go item by item.
+     */
+
+    bits  = NULL;
+    nword = 0;
+
+    if (a->bits != NULL && b->bits != NULL) {
+        na = a->nword;
+        nb = b->nword;
+
+        switch (op) {
+        case SET_UNION:        nword = na > nb ? na : nb; break;
+        case SET_INTERSECTION: nword = na < nb ? na : nb; break;
+        default:               nword = na;                break;
+        }
+
+        if ((bits = calloc(nword + 1, sizeof(*bits))) == NULL)
+            return ENOMEM;
+
+        switch (op) {
+        case SET_UNION:
+            for (i = 0; i < na; i++)
+                bits[i] = a->bits[i];
+            for (i = 0; i < nb; i++)
+                bits[i] |= b->bits[i];
+            break;
+        case SET_INTERSECTION:
+            for (i = 0; i < nword; i++)
+                bits[i] = a->bits[i] & b->bits[i];
+            break;
+        case SET_DIFFERENCE:
+            for (i = 0; i < nword; i++)
+                bits[i] = a->bits[i] & ~(i < nb ? b->bits[i] : 0);
+            break;
+        }
+
+        for (i = 0, nitem = 0; i < nword; i++)
+            nitem += __builtin_popcountll(bits[i]);
+
+        if ((items = calloc(nitem + 1, sizeof(*items))) == NULL) {
+            free(bits);
+            return ENOMEM;
+        }
+
+        for (i = 0, nitem = 0; i < nword; i++) {
+            for (w = bits[i]; w != 0; w &= w - 1) {
+                idx = i * BITS + __builtin_ctzll(w);
+                items[nitem++] = item_ref(item_at(idx));
+            }
+        }
+    }
+    else {
+        switch (op) {
+        case SET_UNION:        nitem = a->nitem + b->nitem; break;
+        default:               nitem = a->nitem;            break;
+        }
+
+        if ((items = calloc(nitem + 1, sizeof(*items))) == NULL)
+            return ENOMEM;
+
+        nitem = 0;
+        for (i = 0; i < a->nitem; i++) {
+            item = a->items[i];
+            if (op == SET_UNION ||
+                (op == SET_INTERSECTION) == !!set_has(b, item))
+                items[nitem++] = item_ref(item);
+        }
+        if (op == SET_UNION)
+            for (i = 0; i < b->nitem; i++)
+                if (!set_has(a, b->items[i]))
+                    items[nitem++] = item_ref(b->items[i]);
+    }
+
+    return set_assign(dst, items, nitem, bits, nword);
+}
+
+
+/********************
+ * set_union
+ ********************/
+int
+set_union(set_t *dst, set_t *a, set_t *b)
+{
+    return set_combine(dst, a, b, SET_UNION);
+}
+
+
+/********************
+ * set_intersection
+ ********************/
+int
+set_intersection(set_t *dst, set_t *a, set_t *b)
+{
+    return set_combine(dst, a, b, SET_INTERSECTION);
+}
+
+
+/********************
+ * set_difference
+ ********************/
+int
+set_difference(set_t *dst, set_t *a, set_t *b)
+{
+    return set_combine(dst, a, b, SET_DIFFERENCE);
+}
+
+
+/********************
+ * set_subset
+ ********************/
+int
+set_subset(set_t *a, set_t *b)
+{
+    uint64_t diff;
+    int      i;
+
+    if (a->nitem > b->nitem)
+        return 0;
+
+    if (a->bits != NULL && b->bits != NULL) {
+        for (i = 0, diff = 0; i < a->nword; i++)
+            diff |= a->bits[i] & ~(i < b->nword ? b->bits[i] : 0);
+        return diff == 0;
+    }
+
+    for (i = 0; i < a->nitem; i++)
+        if (!set_has(b, a->items[i]))
+            return 0;
+
+    return 1;
+}
+
+
+#ifdef __TEST__
+
+static int
+check(set_t *set, char *what, int (*member)(int), int n)
+{
+    char name[16];
+    int  i, nitem;
+
+    for (i = 0, nitem = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "item%d", i);
+        if (set_member(set, name) != member(i)) {
+            printf("%s: wrong membership for %s\n", what, name);
+            exit(1);
+        }
+        nitem += member(i);
+    }
+    if (set->nitem != nitem) {
+        printf("%s: %d items instead of %d\n", what, set->nitem, nitem);
+        exit(1);
+    }
+    printf("%s: %d items (%s) ok\n", what, nitem,
+           set->bits ? "bitmap" : "hash");
+
     return 0;
 }
 
+static int even(int i)   { return !(i & 1); }
+static int third(int i)  { return !(i % 3); }
+static int either(int i) { return even(i) || third(i); }
+static int both(int i)   { return even(i) && third(i); }
+static int evenonly(int i) { return even(i) && !third(i); }
+static int none(int i)   { return i < 0; }
+static int all(int i)    { return i >= 0; }
+
+int
+main(int argc, char *argv[])
+{
+    set_t *a, *b, *c, *sparse;
+    char  *items[1001], names[1000][16];
+    int    i, n = 1000;
+
+    for (i = 0; i < n; i++) {
+        snprintf(names[i], sizeof(names[i]), "item%d", i);
+        items[i] = names[i];
+    }
+    items[n] = NULL;
+
+    if ((a = set_create("a", NULL)) == NULL ||
+        (b = set_create("b", NULL)) == NULL ||
+        (c = set_create("c", NULL)) == NULL)
+        exit(1);
+
+    /* make the first 1000 interned indices ours, c keeps them alive */
+    if (set_insert_many(c, items))
+        exit(1);
+    check(c, "bulk", all, n);
+
+    for (i = 0; i < n; i++)
+        if ((even(i) && set_insert(a, items[i])) ||
+            (third(i) && set_insert(b, items[i])))
+            exit(1);
+    check(a, "even", even, n);
+    check(b, "third", third, n);
+
+    set_union(c, a, b);
+    check(c, "union", either, n);
+    set_intersection(c, a, b);
+    check(c, "intersection", both, n);
+    set_difference(c, a, b);
+    check(c, "difference", evenonly, n);
+
+    if (set_subset(a, b) || !set_subset(c, a) || set_subset(a, c))
+        exit(1);
+
+    /* sparse sets hash their items */
+    if ((sparse = set_create("sparse", NULL)) == NULL ||
+        set_insert(sparse, "item0") || set_insert(sparse, "item999"))
+        exit(1);
+    printf("sparse: %s\n", sparse->bits ? "bitmap" : "hash");
+
+    set_union(c, sparse, b);
+    check(c, "mixed union", third, n);
+    set_intersection(c, a, sparse);
+    if (c->nitem != 1 || !set_member(c, "item0"))
+        exit(1);
+
+    {
+        set_t *h;
+        char   name[32];
+
+        /* these get dense indices after item999, so h stays a bitmap */
+        if ((h = set_create("grown", NULL)) == NULL)
+            exit(1);
+        for (i = 0; i < 100; i++) {
+            snprintf(name, sizeof(name), "grown%d", i * 97);
+            if (set_insert(h, name) || (i == 0 && set_insert(h, "item999")))
+                exit(1);
+        }
+        if (h->nitem != 101)
+            exit(1);
+        for (i = 0; i < 100; i += 2) {
+            snprintf(name, sizeof(name), "grown%d", i * 97);
+            if (set_delete(h, name) || set_member(h, name))
+                exit(1);
+        }
+        for (i = 1; i < 100; i += 2) {
+            snprintf(name, sizeof(name), "grown%d", i * 97);
+            if (!set_member(h, name))
+                exit(1);
+        }
+        if (!set_member(h, "item999") || set_delete(h, "nothere") != ENOENT)
+            exit(1);
+        set_destroy(h);
+
+        if (sparse->bits != NULL || set_delete(sparse, "item0") ||
+            set_member(sparse, "item0") || !set_member(sparse, "item999"))
+            exit(1);
+        printf("grown and hashed sets ok\n");
+    }
+
+    for (i = 0; i < n; i++)
+        if (even(i) && set_delete(a, items[i]))
+            exit(1);
+    check(a, "deleted", none, n);
+    for (i = 0; i < n; i++)
+        if (third(i) && set_delete(b, items[i]))
+            exit(1);
+    check(b, "deleted", none, n);
+
+    set_destroy(a);
+    set_destroy(b);
+    set_destroy(c);
+    set_destroy(sparse);
+
+    if (item_find("item0") != NULL)
+        exit(1);
+    printf("set algebra ok\n");
+
+    return 0;
+}
+
+#endif /* __TEST__ */
+
+
+
 
 /* 
  * Local Variables:
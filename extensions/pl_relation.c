@@ -30,10 +30,21 @@ USA.
 #include <prolog/relation.h>
 
 typedef struct {
-    relation_t *r;
-    int         idx;
+    relation_snapshot_t *s;                  /* snapshot we iterate */
+    int                  idx;
+    int                 *slots;              /* candidate tuples, if any */
+    int                  nslot;              /* number of candidates */
+    int                  bound[0];           /* bound item ids, -1 if not */
 } context_t;
 
+typedef struct {
+    relation_snapshot_t *left;               /* left relation */
+    relation_snapshot_t *right;              /* right relation */
+    relation_pair_t     *pairs;              /* joined tuples */
+    int                  npair;              /* number of joined tuples */
+    int                  idx;                /* next pair to try */
+} join_t;
+
 
 /*************************
  * list_length
@@ -78,19 +89,80 @@ list_new(int arity)
 }
 
 
+/********************
+ * put_item
+ ********************/
+static void
+put_item(term_t pl_item, item_type_t type, item_t item)
+{
+    /* items of typed columns are given to prolog as numbers */
+    switch (type) {
+    case ITEM_INT:
+        PL_put_integer(pl_item, item_int(item));
+        break;
+    case ITEM_DOUBLE:
+        if (item_type(item) == ITEM_INT)
+            PL_put_integer(pl_item, item_int(item));
+        else
+            PL_put_float(pl_item, item_double(item));
+        break;
+    default:
+        PL_put_atom_chars(pl_item, item);
+    }
+}
+
+
+/********************
+ * get_item
+ ********************/
+static int
+get_item(term_t pl_item, item_type_t type, item_t *item)
+{
+    long   i;
+    double d;
+
+    /*
+     * Look up the interned item of a bound argument. Numbers are only
+     * accepted for typed columns. A NULL item means the argument is not
+     * an item of any relation.
+     */
+
+    if (PL_get_atom_chars(pl_item, item)) {
+        *item = item_find(*item);
+        return TRUE;
+    }
+
+    switch (type) {
+    case ITEM_INT:
+        if (!PL_get_long(pl_item, &i))
+            return FALSE;
+        *item = item_find_int(i);
+        return TRUE;
+    case ITEM_DOUBLE:
+        if (!PL_get_float(pl_item, &d))
+            return FALSE;
+        *item = item_find_double(d);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+
 /********************
  * list_of_relation
  ********************/
 static term_t
-list_of_relation(relation_t *r, int i)
+list_of_relation(relation_snapshot_t *s, int i)
 {
-    int    n    = r->arity;
+    int    n    = s->arity;
     term_t list = PL_new_term_ref();
     term_t item = PL_new_term_ref();
     
     PL_put_nil(list);
     while (n-- > 0) {
-        PL_put_atom_chars(item, r->items[r->relations[i][n]]);
+        put_item(item, s->r->types ? s->r->types[n] : ITEM_STRING,
+                 s->items[s->relations[i][n]]);
         PL_cons_list(list, item, list);
     }
     
@@ -98,6 +170,115 @@ list_of_relation(relation_t *r, int i)
 }
 
 
+/********************
+ * get_relation
+ ********************/
+static relation_t *
+get_relation(term_t pl_relation)
+{
+    char *name;
+    int   handle;
+
+    /* a relation is either given by name or by a handle */
+    if (PL_get_atom_chars(pl_relation, &name))
+        return relation_lookup(name);
+    else if (PL_get_integer(pl_relation, &handle))
+        return relation_find(handle);
+    else
+        return NULL;
+}
+
+
+/********************
+ * pl_relation_handle
+ ********************/
+static foreign_t
+pl_relation_handle(term_t pl_name, term_t pl_handle)
+{
+    relation_t *r;
+
+    if ((r = get_relation(pl_name)) == NULL)
+        PL_fail;
+
+    return PL_unify_integer(pl_handle, r->handle);
+}
+
+
+/********************
+ * bind_items
+ ********************/
+static int
+bind_items(relation_t *r, context_t *ctx, term_t pl_list)
+{
+    term_t      pl_head, pl_tail;
+    item_t      item;
+    int         i, n, column, nslot, *slots, *best;
+
+    /*
+     * Collect the ids of the items already bound in the query. Pick the
+     * bound column with the fewest tuples and iterate only through those.
+     * If a bound item is not in the relation at all, there is no match.
+     * The candidates are copied as the index changes with the relation.
+     */
+
+    pl_head = PL_new_term_ref();
+    pl_tail = PL_copy_term_ref(pl_list);
+
+    column = -1;
+    nslot  = 0;
+    best   = NULL;
+    for (i = 0; i < r->arity && PL_get_list(pl_tail, pl_head, pl_tail); i++) {
+        ctx->bound[i] = -1;
+
+        if (PL_is_variable(pl_head))
+            continue;
+
+        if (!get_item(pl_head, r->types ? r->types[i] : ITEM_STRING, &item) ||
+            item == NULL || (ctx->bound[i] = relation_item(r, item)) < 0)
+            return FALSE;
+
+        if ((n = relation_postings(r, i, ctx->bound[i], &slots)) < 0)
+            continue;                        /* no index, just scan */
+
+        if (column < 0 || n < nslot) {
+            column = i;
+            nslot  = n;
+            best   = slots;
+        }
+    }
+
+    if (column >= 0) {
+        if (nslot == 0)
+            return FALSE;
+        if ((ctx->slots = malloc(nslot * sizeof(ctx->slots[0]))) == NULL)
+            return FALSE;
+        memcpy(ctx->slots, best, nslot * sizeof(ctx->slots[0]));
+        ctx->nslot = nslot;
+    }
+    else
+        ctx->nslot = -1;
+
+    return TRUE;
+}
+
+
+/********************
+ * bound_match
+ ********************/
+static int
+bound_match(context_t *ctx, int slot)
+{
+    relation_snapshot_t *s = ctx->s;
+    int                  i;
+
+    for (i = 0; i < s->arity; i++)
+        if (ctx->bound[i] >= 0 && s->relations[slot][i] != ctx->bound[i])
+            return FALSE;
+
+    return TRUE;
+}
+
+
 /********************
  * pl_related
  ********************/
@@ -106,28 +287,31 @@ pl_related(term_t pl_name, term_t pl_list, control_t handle)
 {
     context_t  *ctx;
     relation_t *r;
-    char       *name;
-    int         arity, idx;
+    int         arity, idx, n;
     fid_t       frame;
     term_t      pl_items;
+
+    /*
+     * We iterate over a snapshot of the relation, so changes made to it
+     * while we have a choice point open do not affect the solutions.
+     */
     
     switch (PL_foreign_control(handle)) {
     case PL_FIRST_CALL:
-        if (!PL_is_atom(pl_name))
-            PL_fail;
-
-        PL_get_atom_chars(pl_name, &name);
-        if ((r = relation_lookup(name)) == NULL)
+        if ((r = get_relation(pl_name)) == NULL)
             PL_fail;
 
         if (!PL_is_list(pl_list) || (arity = list_length(pl_list)) != r->arity)
             PL_fail;
 
-        if ((ctx = malloc(sizeof(*ctx))) == NULL)
+        if ((ctx = malloc(sizeof(*ctx) + arity * sizeof(int))) == NULL)
             PL_fail;
         memset(ctx, 0, sizeof(*ctx));
-        ctx->r   = r;
         ctx->idx = 0;
+
+        if ((ctx->s = relation_snapshot(r)) == NULL ||
+            !bind_items(r, ctx, pl_list))
+            goto nomore;
         break;
         
     case PL_REDO:
@@ -142,10 +326,14 @@ pl_related(term_t pl_name, term_t pl_list, control_t handle)
         PL_fail;
     }
 
-    r = ctx->r;
     frame = PL_open_foreign_frame();
-    while ((idx = ctx->idx++) < ctx->r->nrelation) {
-        pl_items = list_of_relation(r, idx);
+    n = ctx->nslot >= 0 ? ctx->nslot : ctx->s->nrelation;
+    while ((idx = ctx->idx++) < n) {
+        if (ctx->nslot >= 0)
+            idx = ctx->slots[idx];
+        if (!bound_match(ctx, idx))
+            continue;
+        pl_items = list_of_relation(ctx->s, idx);
         if (PL_unify(pl_list, pl_items)) {
             PL_close_foreign_frame(frame);
             PL_retry_address(ctx);
@@ -155,6 +343,85 @@ pl_related(term_t pl_name, term_t pl_list, control_t handle)
     PL_close_foreign_frame(frame);
     
  nomore:
+    relation_release(ctx->s);
+    free(ctx->slots);
+    free(ctx);
+    PL_fail;
+}
+
+
+/********************
+ * pl_relation_join
+ ********************/
+static foreign_t
+pl_relation_join(term_t pl_left, term_t pl_lcolumn,
+                 term_t pl_right, term_t pl_rcolumn,
+                 term_t pl_litems, term_t pl_ritems, control_t handle)
+{
+    join_t          *ctx;
+    relation_t      *left, *right;
+    relation_pair_t *pair;
+    int              lcolumn, rcolumn, idx;
+    fid_t            frame;
+
+    /*
+     * relation_join(Left, LColumn, Right, RColumn, LItems, RItems):
+     *   LItems and RItems are the tuples of Left and Right that have the
+     *   same item in columns LColumn and RColumn (counting from 1).
+     */
+    
+    switch (PL_foreign_control(handle)) {
+    case PL_FIRST_CALL:
+        if ((left  = get_relation(pl_left))  == NULL ||
+            (right = get_relation(pl_right)) == NULL)
+            PL_fail;
+
+        if (!PL_get_integer(pl_lcolumn, &lcolumn) ||
+            !PL_get_integer(pl_rcolumn, &rcolumn))
+            PL_fail;
+
+        if ((ctx = malloc(sizeof(*ctx))) == NULL)
+            PL_fail;
+        memset(ctx, 0, sizeof(*ctx));
+
+        if ((ctx->left  = relation_snapshot(left))  == NULL ||
+            (ctx->right = relation_snapshot(right)) == NULL)
+            goto nomore;
+
+        ctx->npair = relation_join(left, lcolumn - 1, right, rcolumn - 1,
+                                   &ctx->pairs);
+        if (ctx->npair <= 0)
+            goto nomore;
+        break;
+        
+    case PL_REDO:
+        ctx = PL_foreign_context_address(handle);
+        break;
+        
+    case PL_CUTTED:
+        ctx = PL_foreign_context_address(handle);
+        goto nomore;
+
+    default:
+        PL_fail;
+    }
+
+    frame = PL_open_foreign_frame();
+    while ((idx = ctx->idx++) < ctx->npair) {
+        pair = ctx->pairs + idx;
+        if (PL_unify(pl_litems, list_of_relation(ctx->left, pair->left)) &&
+            PL_unify(pl_ritems, list_of_relation(ctx->right, pair->right))) {
+            PL_close_foreign_frame(frame);
+            PL_retry_address(ctx);
+        }
+        PL_rewind_foreign_frame(frame);
+    }
+    PL_close_foreign_frame(frame);
+    
+ nomore:
+    relation_release(ctx->left);
+    relation_release(ctx->right);
+    free(ctx->pairs);
     free(ctx);
     PL_fail;
 }
@@ -168,6 +435,9 @@ install(void)
 {
     PL_register_foreign("related", 2, pl_related, PL_FA_NONDETERMINISTIC);
     PL_register_foreign("in_relation", 2, pl_related, PL_FA_NONDETERMINISTIC);
+    PL_register_foreign("relation_handle", 2, pl_relation_handle, 0);
+    PL_register_foreign("relation_join", 6, pl_relation_join,
+                        PL_FA_NONDETERMINISTIC);
 }
 
 /* 
@@ -37,6 +37,40 @@ typedef struct {
 
 
 
+/********************
+ * get_set
+ ********************/
+static set_t *
+get_set(term_t pl_set)
+{
+    char *name;
+    int   handle;
+
+    /* a set is either given by name or by a handle */
+    if (PL_get_atom_chars(pl_set, &name))
+        return set_lookup(name);
+    else if (PL_get_integer(pl_set, &handle))
+        return set_find(handle);
+    else
+        return NULL;
+}
+
+
+/********************
+ * pl_set_handle
+ ********************/
+static foreign_t
+pl_set_handle(term_t pl_name, term_t pl_handle)
+{
+    set_t *set;
+
+    if ((set = get_set(pl_name)) == NULL)
+        PL_fail;
+
+    return PL_unify_integer(pl_handle, set->handle);
+}
+
+
 /********************
  * pl_set_destroy
  ********************/
@@ -44,14 +78,8 @@ static foreign_t
 pl_set_destroy(term_t pl_name)
 {
     set_t *set;
-    char  *name;
         
-    if (!PL_is_atom(pl_name))
-        PL_fail;
-    
-    PL_get_atom_chars(pl_name, &name);
-    
-    if ((set = set_lookup(name)) == NULL)
+    if ((set = get_set(pl_name)) == NULL)
         PL_fail;
         
     set_destroy(set);
@@ -66,15 +94,14 @@ static foreign_t
 pl_set_insert(term_t pl_name, term_t pl_item)
 {
     set_t *set;
-    char  *name, *item;
+    char  *item;
         
-    if (!PL_is_atom(pl_name) || !PL_is_atom(pl_item))
+    if (!PL_is_atom(pl_item))
         PL_fail;
     
-    PL_get_atom_chars(pl_name, &name);
     PL_get_atom_chars(pl_item, &item);
     
-    if ((set = set_lookup(name)) == NULL || set_insert(set, item))
+    if ((set = get_set(pl_name)) == NULL || set_insert(set, item))
         PL_fail;
     else
         PL_succeed;
@@ -88,15 +115,14 @@ static foreign_t
 pl_set_delete(term_t pl_name, term_t pl_item)
 {
     set_t *set;
-    char  *name, *item;
+    char  *item;
         
-    if (!PL_is_atom(pl_name) || !PL_is_atom(pl_item))
+    if (!PL_is_atom(pl_item))
         PL_fail;
     
-    PL_get_atom_chars(pl_name, &name);
     PL_get_atom_chars(pl_item, &item);
     
-    if ((set = set_lookup(name)) == NULL || set_delete(set, item))
+    if ((set = get_set(pl_name)) == NULL || set_delete(set, item))
         PL_fail;
     else
         PL_succeed;
@@ -110,14 +136,8 @@ static foreign_t
 pl_set_reset(term_t pl_name)
 {
     set_t     *set;
-    char      *name;
         
-    if (!PL_is_atom(pl_name))
-        PL_fail;
-    
-    PL_get_atom_chars(pl_name, &name);
-    
-    if ((set = set_lookup(name)) == NULL)
+    if ((set = get_set(pl_name)) == NULL)
         PL_fail;
    
     set_reset(set);
@@ -133,18 +153,21 @@ pl_set_member(term_t pl_name, term_t pl_item, control_t handle)
 {
     context_t *ctx;
     set_t     *set;
-    char      *name;
+    char      *item;
     int        idx;
     term_t     pl_member;
     
     switch (PL_foreign_control(handle)) {
     case PL_FIRST_CALL:
-        if (!PL_is_atom(pl_name))
+        if ((set = get_set(pl_name)) == NULL)
             PL_fail;
 
-        PL_get_atom_chars(pl_name, &name);
-        if ((set = set_lookup(name)) == NULL)
-            PL_fail;
+        if (PL_get_atom_chars(pl_item, &item)) {  /* a simple lookup */
+            if (set_member(set, item))
+                PL_succeed;
+            else
+                PL_fail;
+        }
 
         if ((ctx = malloc(sizeof(*ctx))) == NULL)
             PL_fail;
@@ -179,6 +202,97 @@ pl_set_member(term_t pl_name, term_t pl_item, control_t handle)
 }
 
 
+/********************
+ * set_algebra
+ ********************/
+static foreign_t
+set_algebra(term_t pl_a, term_t pl_b, term_t pl_items,
+            int (*op)(set_t *, set_t *, set_t *))
+{
+    set_t  *a, *b, *result;
+    term_t  pl_list, pl_item;
+    int     i;
+
+    /*
+     * Combine sets a and b into a temporary unregistered set and unify
+     * the items of the result, as a list, with pl_items.
+     */
+
+    if ((a = get_set(pl_a)) == NULL || (b = get_set(pl_b)) == NULL)
+        PL_fail;
+
+    if ((result = malloc(sizeof(*result))) == NULL)
+        PL_fail;
+    memset(result, 0, sizeof(*result));
+
+    if (op(result, a, b) != 0) {
+        set_destroy(result);
+        PL_fail;
+    }
+
+    pl_list = PL_new_term_ref();
+    pl_item = PL_new_term_ref();
+
+    PL_put_nil(pl_list);
+    for (i = result->nitem - 1; i >= 0; i--) {
+        PL_put_atom_chars(pl_item, result->items[i]);
+        PL_cons_list(pl_list, pl_item, pl_list);
+    }
+
+    set_destroy(result);
+
+    return PL_unify(pl_items, pl_list);
+}
+
+
+/********************
+ * pl_set_union
+ ********************/
+static foreign_t
+pl_set_union(term_t pl_a, term_t pl_b, term_t pl_items)
+{
+    return set_algebra(pl_a, pl_b, pl_items, set_union);
+}
+
+
+/********************
+ * pl_set_intersection
+ ********************/
+static foreign_t
+pl_set_intersection(term_t pl_a, term_t pl_b, term_t pl_items)
+{
+    return set_algebra(pl_a, pl_b, pl_items, set_intersection);
+}
+
+
+/********************
+ * pl_set_difference
+ ********************/
+static foreign_t
+pl_set_difference(term_t pl_a, term_t pl_b, term_t pl_items)
+{
+    return set_algebra(pl_a, pl_b, pl_items, set_difference);
+}
+
+
+/********************
+ * pl_set_subset
+ ********************/
+static foreign_t
+pl_set_subset(term_t pl_a, term_t pl_b)
+{
+    set_t *a, *b;
+
+    if ((a = get_set(pl_a)) == NULL || (b = get_set(pl_b)) == NULL)
+        PL_fail;
+
+    if (set_subset(a, b))
+        PL_succeed;
+    else
+        PL_fail;
+}
+
+
 /********************
  * install
  ********************/
@@ -193,6 +307,11 @@ install(void)
     PL_register_foreign("set_delete" , 2, pl_set_delete , 0);
     PL_register_foreign("set_reset"  , 1, pl_set_reset  , 0);
     PL_register_foreign("set_member" , 2, pl_set_member,PL_FA_NONDETERMINISTIC);
+    PL_register_foreign("set_handle" , 2, pl_set_handle , 0);
+    PL_register_foreign("set_union"       , 3, pl_set_union       , 0);
+    PL_register_foreign("set_intersection", 3, pl_set_intersection, 0);
+    PL_register_foreign("set_difference"  , 3, pl_set_difference  , 0);
+    PL_register_foreign("set_subset"      , 2, pl_set_subset      , 0);
 }
 
 
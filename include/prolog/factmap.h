@@ -30,10 +30,24 @@ USA.
 
 /*
  * structure to glue the factstore to the prologish relation
+ *
+ * A factmap created with column types maps numeric fields to numeric
+ * items directly, without converting their values to strings, and the
+ * columns of its relation are typed accordingly (see relation.h).
+ *
+ * By default a factmap is refreshed only by calling factmap_update. In
+ * the other refresh modes it listens to its fact store and applies the
+ * changes either when the relation is read next or from an idle callback.
  */
 
 typedef struct factmap_s factmap_t;
 
+typedef enum {
+    FACTMAP_MANUAL = 0,                     /* refreshed by factmap_update */
+    FACTMAP_LAZY,                           /* refreshed on first read */
+    FACTMAP_IDLE                            /* refreshed when idle */
+} factmap_refresh_t;
+
 struct factmap_s {
     OhmFactStore      *store;                         /* fact store */
     OhmFactStoreView  *view;                          /* fact store view */
@@ -43,14 +57,28 @@ struct factmap_s {
     relation_t       *relation;                       /* associated relation */
     int             (*filter)(int, char **, void *);  /* optional filter */
     void             *filter_data;                    /* optional filter data */
+    GHashTable       *facts;                          /* fact -> row */
+    GHashTable       *rows;                           /* items -> row */
+    factmap_refresh_t mode;                           /* refresh mode */
+    GQuark            qkey;                           /* key as a quark */
+    gulong            handlers[3];                    /* store signals */
+    guint             idle;                           /* idle refresh */
+    int               dirty;                          /* store has changed */
+    int               mistyped;                       /* warned of bad types */
 };
 
 
 factmap_t *factmap_create (OhmFactStore *store,
                            char *name, char *factkey, char **members,
                            int (*filter)(int, char **, void *), void *data);
+factmap_t *factmap_create_typed(OhmFactStore *store,
+                                char *name, char *factkey, char **members,
+                                item_type_t *types,
+                                int (*filter)(int, char **, void *),
+                                void *data);
 void       factmap_destroy(factmap_t *map);
 int        factmap_update (factmap_t *map);
+int        factmap_set_refresh(factmap_t *map, factmap_refresh_t mode);
 void       factmap_dump   (factmap_t *map);
 
 
@@ -0,0 +1,87 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#ifndef POLICY_INTERN_H
+#define POLICY_INTERN_H
+
+
+/*
+ * Notes:
+ *   Items (set members, relation items, fact field names) are interned
+ *   in a single global table. Each distinct string is stored only once
+ *   and an interned item is the address of that single copy, so items
+ *   can be compared for equality by pointer and printed directly.
+ *
+ *   Entries are reference counted. item_intern takes a reference, which
+ *   needs to be released with item_unref once the item is not used any
+ *   more. item_find only looks up already interned items without taking
+ *   a reference, which is handy for membership tests.
+ *
+ *   Each interned item also has a small integer index. Indices are dense
+ *   and reused once an item is released, so they can be used as bit
+ *   numbers in bitmaps of items.
+ *
+ *   Numbers are interned in a canonical textual form. Items in canonical
+ *   integer or floating point form remember their numeric value, so the
+ *   value of a numeric item can be read back without parsing it again.
+ *   item_name_type tells the type a name has or would have once interned.
+ */
+
+typedef char *item_t;
+
+typedef enum {
+    ITEM_STRING = 0,                             /* any item */
+    ITEM_INT,                                    /* canonical integer */
+    ITEM_DOUBLE                                  /* canonical non-integer */
+} item_type_t;
+
+item_t item_intern(const char *name);
+item_t item_find  (const char *name);
+item_t item_ref   (item_t item);
+void   item_unref (item_t item);
+int    item_index (item_t item);
+item_t item_at    (int index);
+
+item_t      item_intern_int   (long value);
+item_t      item_intern_double(double value);
+item_t      item_find_int     (long value);
+item_t      item_find_double  (double value);
+item_type_t item_type         (item_t item);
+item_type_t item_name_type    (const char *name);
+long        item_int          (item_t item);
+double      item_double       (item_t item);
+
+#define item_lookup(item) ((char *)(item))
+
+
+#endif /* POLICY_INTERN_H */
+
+
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+*/
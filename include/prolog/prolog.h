@@ -72,6 +72,19 @@ typedef struct {
 } prolog_allocator_t;
 
 
+/*
+ * difference between two successive results of a predicate
+ */
+
+typedef struct {
+    char ***added;                           /* new objects */
+    char ***removed;                         /* objects gone */
+    char ***changed;                         /* changed fields of objects */
+    char ***previous;                        /* their previous values */
+    char ***exception;                       /* exception, if any */
+} prolog_delta_t;
+
+
 /*
  * logging
  */
@@ -89,6 +102,10 @@ int  prolog_init(char *, int, int, int, int, char *);
 void prolog_exit(void);
 int  prolog_set_helper(const char *path);
 int  prolog_set_allocator(prolog_allocator_t *allocator);
+int  prolog_set_arena(size_t chunk_size);
+int  prolog_set_memprof(int enable);
+void prolog_dump_memprof(void);
+int  prolog_memprof_statistics(size_t *live, size_t *peak, int *nsite);
 
 void prolog_set_logger(void (*app_logger)(prolog_log_level_t, const char *,
                                           va_list));
@@ -111,6 +128,15 @@ int     prolog_vcall     (prolog_predicate_t *p, void *ret,
                           va_list ap);
 #define prolog_callarr prolog_acall
 
+int     prolog_acall_delta (prolog_predicate_t *p, prolog_delta_t *delta,
+                            void **args, int narg);
+void    prolog_free_delta  (prolog_delta_t *delta);
+void    prolog_dump_delta  (prolog_delta_t *delta);
+void    prolog_forget_results(prolog_predicate_t *p);
+
+int     prolog_acall_packed(prolog_predicate_t *p, void *buf, size_t *size,
+                            void **args, int narg);
+
 int     prolog_trace_set(char *commands);
 void    prolog_trace_show(char *predicate);
 
@@ -125,6 +151,19 @@ void prolog_dump_exception(char ***exception);
 void prolog_free_objects(char ***objects);
 void prolog_dump_objects(char ***objects);
 
+int         prolog_packed_check    (const void *buf, size_t size);
+size_t      prolog_packed_size     (const void *buf);
+const char *prolog_packed_exception(const void *buf);
+int         prolog_packed_count    (const void *buf);
+int         prolog_packed_nfield   (const void *buf, int obj);
+int         prolog_packed_lookup   (const void *buf, int obj, const char *name);
+const char *prolog_packed_name     (const void *buf, int obj, int field);
+int         prolog_packed_type     (const void *buf, int obj, int field);
+const char *prolog_packed_string   (const void *buf, int obj, int field);
+int         prolog_packed_integer  (const void *buf, int obj, int field);
+double      prolog_packed_double   (const void *buf, int obj, int field);
+void        prolog_dump_packed     (const void *buf);
+
 int prolog_shell(int in);
 
 
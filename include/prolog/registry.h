@@ -0,0 +1,72 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#ifndef POLICY_REGISTRY_H
+#define POLICY_REGISTRY_H
+
+#include <stddef.h>
+
+
+/*
+ * Notes:
+ *   A registry keeps track of named objects (relations, sets). Objects
+ *   are hashed by name and each object registered gets a small integer
+ *   handle. Handles stay valid as long as the object is registered and
+ *   are not mistaken for a later object reusing the same slot, so they
+ *   can be handed out to prolog to avoid repeated name lookups.
+ */
+
+typedef struct {
+    void         **hash;                        /* objects hashed by name */
+    int            nhash;                       /* size of hash */
+    int            nobject;                     /* number of objects */
+    void         **objects;                     /* objects by handle */
+    unsigned int  *gens;                        /* handle generations */
+    int           *next;                        /* free slot chain */
+    int            free;                        /* first free slot + 1 */
+    int            nslot;                       /* size of objects */
+    size_t         name_offs;                   /* offset of char *name */
+    size_t         handle_offs;                 /* offset of int handle */
+} registry_t;
+
+#define REGISTRY_INIT(type)                                     \
+    { NULL, 0, 0, NULL, NULL, NULL, 0, 0,                       \
+      offsetof(type, name), offsetof(type, handle) }
+
+int   registry_add   (registry_t *reg, void *obj);
+void  registry_del   (registry_t *reg, void *obj);
+void *registry_lookup(registry_t *reg, const char *name);
+void *registry_find  (registry_t *reg, int handle);
+
+
+#endif /* POLICY_REGISTRY_H */
+
+
+
+
+/* 
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+*/
@@ -24,51 +24,145 @@ USA.
 #ifndef POLICY_RELATION_H
 #define POLICY_RELATION_H
 
+#include <stdint.h>
+
 #include "list.h"
+#include "intern.h"
+#include "registry.h"
 
 
 /*
  * Notes:
  *   Sets and relations operate on items. For generality and language
  *   independence we want items to be strings. For speed, however, we'd
- *   like to define the actual operations on integers. We might want to
- *   use something similar to X atoms, where we intern items by name and
- *   later refer to them by the unique integer ID we get back.
- *
- *   We could have it in the APIs without actually needing to implement it
- *   at the beginning by defining dummy typedef and macros like this...
+ *   like to define the actual operations on integers. Items are interned
+ *   (see intern.h) and each relation maps the items it uses to small
+ *   integer IDs local to the relation.
  */
 
-typedef char *item_t;
+
+typedef struct {
+    int            *slots;                   /* tuples with this item */
+    int             nslot;                   /* number of tuples */
+    int             size;                    /* allocated size */
+} relation_posting_t;
+
+
+typedef struct {
+    int             left;                    /* tuple in left relation */
+    int             right;                   /* tuple in right relation */
+} relation_pair_t;
+
+
+typedef struct relation_s          relation_t;
+typedef struct relation_snapshot_s relation_snapshot_t;
+typedef struct relation_garbage_s  relation_garbage_t;
+
 
 /*
-item_t item_intern(char *item);
-char * item_resolv(item_t item);
-*/
+ * Notes:
+ *   Columns are untyped unless relation_set_types has been called. Each
+ *   item of a typed column must be a number of the column type in its
+ *   canonical form (see intern.h). An integer column accepts integers
+ *   only; a floating point column accepts integers, too.
+ */
+
+
+/*
+ * Notes:
+ *   Relations mirroring some other data (for instance a factmap) can be
+ *   kept up to date lazily. The owner of the data installs a refresh
+ *   callback and marks the relation stale with relation_invalidate when
+ *   the data changes. The callback is then run by the next reader of the
+ *   relation (relation_snapshot, relation_member, relation_select, ...).
+ */
+
+
+/*
+ * Notes:
+ *   Readers that need a stable view of a relation across mutations (for
+ *   instance a prolog choice point iterating over it) pin a snapshot. A
+ *   snapshot is an immutable view of the tuples and items of the relation
+ *   at the time it was taken. Taking a snapshot costs O(1): it shares the
+ *   tuple and item arrays of the relation, which are copied on write only
+ *   by the first mutation that would change what the snapshot sees.
+ *   Writers never wait for readers, instead any memory still visible in
+ *   a pinned snapshot is reclaimed only once the last such snapshot is
+ *   released.
+ */
 
-#define item_intern(name) ((item_t)name)
-#define item_lookup(item) ((char *)item)
+struct relation_snapshot_s {
+    relation_t          *r;                  /* relation of this snapshot */
+    int                  refcnt;             /* reference count */
+    unsigned int         epoch;              /* relation epoch at snapshot */
+    int                  arity;              /* relation arity */
+    int                  nrelation;          /* number of tuples */
+    int                **relations;          /* tuples as of snapshot */
+    item_t              *items;              /* items as of snapshot */
+    relation_snapshot_t *next;               /* next older snapshot */
+};
 
 
-typedef struct relation_s {
+struct relation_s {
     char           *name;
-    list_hook_t     hook;
+    int             handle;                  /* registry handle */
     int             arity;
-    char          **items;
+    item_type_t    *types;                   /* column types, if any */
+    item_t         *items;                   /* interned items by id */
     int           **relations;
+    int32_t       **columns;                 /* per-column item ids */
     int             nrelation;
     int             nslot;
-} relation_t;
+    int             nitem;                   /* number of items */
+    int             nitemslot;               /* allocated item slots */
+    int            *itemhash;                /* item name -> id + 1 */
+    int             nitemhash;               /* size of item hash */
+    int            *tuplehash;               /* tuple -> slot + 1 */
+    int             ntuplehash;              /* size of tuple hash */
+    relation_posting_t **index;              /* per-column item -> tuples */
+    int           **indexpos;                /* tuple -> position in posting */
+    int             nindex;                  /* items covered by indexes */
+    void           *map;                     /* mapped file, if any */
+    size_t          mapsize;                 /* size of mapped file */
+    unsigned int    epoch;                   /* bumped by every change */
+    int             shared;                  /* arrays seen by snapshots */
+    relation_snapshot_t *snapshots;          /* pinned snapshots */
+    relation_garbage_t  *garbage;            /* memory pending reclamation */
+    int             destroyed;               /* destroyed while pinned */
+    int           (*refresh)(relation_t *, void *); /* brings r up to date */
+    void           *refresh_data;            /* opaque refresh data */
+    int             stale;                   /* needs a refresh before read */
+};
 
 
 relation_t *relation_create(char *name, int arity, char ***initial_items);
 void        relation_destroy(relation_t *r);
 relation_t *relation_lookup(char *name);
+relation_t *relation_find(int handle);
 int         relation_insert(relation_t *r, char **items);
+int         relation_insert_many(relation_t *r, char ***items);
 int         relation_delete(relation_t *r, char **items);
 void        relation_reset(relation_t *r);
 int         relation_member(relation_t *r, char **items);
 void        relation_dump(relation_t *r);
+int         relation_item(relation_t *r, char *item);
+int         relation_postings(relation_t *r, int column, int item,
+                              int **slots);
+int         relation_select(relation_t *r, char **items,
+                            int *slots, int nslot);
+int         relation_join(relation_t *left, int lcolumn,
+                          relation_t *right, int rcolumn,
+                          relation_pair_t **pairs);
+int         relation_set_types(relation_t *r, item_type_t *types);
+void        relation_set_refresh(relation_t *r,
+                                 int (*refresh)(relation_t *, void *),
+                                 void *data);
+void        relation_invalidate(relation_t *r);
+int         relation_save(relation_t *r, const char *path);
+relation_t *relation_map(char *name, const char *path);
+
+relation_snapshot_t *relation_snapshot(relation_t *r);
+void                 relation_release(relation_snapshot_t *s);
 
 
 
@@ -24,25 +24,40 @@ USA.
 #ifndef POLICY_SET_H
 #define POLICY_SET_H
 
+#include <stdint.h>
+
 #include "list.h"
+#include "intern.h"
+#include "registry.h"
 
 typedef struct set_s {
     char         *name;                             /* name of this set */
-    list_hook_t   hook;                             /* hook to more sets */
-    char        **items;                            /* items in the set */
+    int           handle;                           /* registry handle */
+    item_t       *items;                            /* items in the set */
     int           nitem;                            /* number of items */
     int           nslot;                            /* number of slots */
+    int          *hash;                             /* item -> slot + 1 */
+    int           nhash;                            /* size of hash */
+    uint64_t     *bits;                             /* item index bitmap */
+    int           nword;                            /* size of bitmap */
 } set_t;
 
 set_t *set_create (char *name, char **initial_items);
 void   set_destroy(set_t *set);
 
 set_t *set_lookup(char *name);
+set_t *set_find  (int handle);
 int    set_insert(set_t *set, char *item);
+int    set_insert_many(set_t *set, char **items);
 int    set_delete(set_t *set, char *item);
 void   set_reset (set_t *set);
 int    set_member(set_t *set, char *item);
 
+int    set_union       (set_t *dst, set_t *a, set_t *b);
+int    set_intersection(set_t *dst, set_t *a, set_t *b);
+int    set_difference  (set_t *dst, set_t *a, set_t *b);
+int    set_subset      (set_t *a, set_t *b);
+
 
 
 #endif /* POLICY_SET_H */
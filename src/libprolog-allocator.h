@@ -28,17 +28,33 @@ USA.
 extern prolog_allocator_t __allocator;
 
 
+/*
+ * per-call arena, active only while results are being collected
+ */
+
+typedef struct libprolog_arena_s libprolog_arena_t;
+
+extern libprolog_arena_t *__arena;
+
+void *libprolog_arena_alloc  (libprolog_arena_t *a, size_t size);
+void *libprolog_arena_realloc(libprolog_arena_t *a, void *ptr, size_t size);
+void  libprolog_arena_free   (libprolog_arena_t *a, void *ptr);
+
+
 #define __MALLOC(size, file, line, func)                                  \
-    (__allocator.malloc ?                                                 \
+    (__arena ? libprolog_arena_alloc(__arena, (size)) :                   \
+     __allocator.malloc ?                                                 \
      __allocator.malloc((size), (file), (line), (func)) : malloc((size)))
 
 #define __REALLOC(ptr, size, file, line, func)                          \
-    (__allocator.realloc ?                                              \
+    (__arena ? libprolog_arena_realloc(__arena, (ptr), (size)) :        \
+     __allocator.realloc ?                                              \
      __allocator.realloc((ptr), (size), (file), (line), (func)) :       \
      realloc((ptr), (size)))
 
 #define __FREE(ptr, file, line, func)                               \
-    (__allocator.free ?                                             \
+    (__arena ? libprolog_arena_free(__arena, (ptr)) :               \
+     __allocator.free ?                                             \
      __allocator.free((ptr), (file), (line), (func)) : free((ptr)))
 
 
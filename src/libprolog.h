@@ -99,6 +99,10 @@ enum {
     RESULT_EXCEPTION,
 };
 
+#define RESULT_ARENA       0x100           /* result owns a per-call arena */
+#define RESULT_TYPE(tag)   ((int)(tag) & ~RESULT_ARENA)
+#define RESULT_TAG(type)   ((char **)((type) | (__arena ? RESULT_ARENA : 0)))
+
 
 
 /*
@@ -173,6 +177,31 @@ foreign_t libpl_has_errors(term_t noargs, int arity, void *context);
 /* prolog-predicate.c */
 void libprolog_free_predicates(void);
 
+/* prolog-arena.c */
+int  libprolog_arena_begin(void);
+void libprolog_arena_end(int keep);
+void libprolog_arena_release(void *root);
+
+/* prolog-memprof.c */
+int         libprolog_memprof_chain(prolog_allocator_t *allocator);
+const char *libprolog_memprof_rule(const char *rule);
+void        libprolog_memprof_exit(void);
+
+/* prolog-delta.c */
+void libprolog_delta_exit(void);
+
+/* prolog-packed.c */
+#define PACKED_ALIGN 8                       /* alignment of packed buffers */
+
+typedef struct {
+    char   *buf;                             /* buffer to pack into */
+    size_t  size;                            /* size of the buffer */
+    size_t  used;                            /* amount used (or needed) */
+} libprolog_pack_t;
+
+int libprolog_pack_result(term_t pl_retval, libprolog_pack_t *pack);
+int libprolog_pack_exception(qid_t qid, libprolog_pack_t *pack);
+
 /* prolog-object.c */
 int libprolog_collect_result(term_t pl_retval, void *retval);
 int libprolog_collect_exception(qid_t qid, void *retval);
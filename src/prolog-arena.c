@@ -0,0 +1,326 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <SWI-Stream.h>
+#include <SWI-Prolog.h>
+
+#include <prolog/prolog.h>
+
+#include "libprolog.h"
+
+
+/*
+ * per-call bump allocator
+ *
+ * Notes:
+ *     When enabled, every evaluation gets its own arena. While the result
+ *     (or exception) of the evaluation is being collected all allocations
+ *     are bumped off the chunks of this arena. The first allocation, ie.
+ *     the tagged result array itself, is the root of the arena. The root
+ *     may not fit the first chunk and land in a chunk of its own, so its
+ *     header also carries a pointer back to the arena. This gets us from
+ *     the result back to the arena without any lookups. Freeing the
+ *     result releases all the chunks of the arena in one go.
+ *
+ *     Every allocation is prefixed by its requested size. This lets us
+ *     implement realloc and lets us give back the last allocation of a
+ *     chunk on free (which is what typically happens on error paths).
+ */
+
+#define ARENA_ALIGN        8
+#define ARENA_ALIGNED(n)   (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HDR          ARENA_ALIGNED(sizeof(size_t))
+#define ARENA_LINK         ARENA_ALIGNED(sizeof(void *))     /* root only */
+#define ARENA_MIN_CHUNK    256
+#define ARENA_MAGIC        0x4152454eU                  /* 'AREN' */
+
+typedef struct arena_chunk_s arena_chunk_t;
+
+struct arena_chunk_s {
+    arena_chunk_t *next;                     /* next (older) chunk */
+    char          *data;                     /* beginning of usable space */
+    size_t         size;                     /* amount of usable space */
+    size_t         used;                     /* amount of space used */
+};
+
+struct libprolog_arena_s {
+    unsigned int   magic;                    /* ARENA_MAGIC */
+    arena_chunk_t *chunks;                   /* current (newest) chunk */
+    void          *root;                     /* first allocation, result */
+    arena_chunk_t  first;                    /* first chunk, embedded */
+};
+
+#define ARENA_SIZE ARENA_ALIGNED(sizeof(libprolog_arena_t))
+#define CHUNK_SIZE ARENA_ALIGNED(sizeof(arena_chunk_t))
+
+
+libprolog_arena_t *__arena     = NULL;       /* arena being allocated from */
+static size_t      arena_chunk = 0;          /* chunk size, 0 = disabled */
+
+
+/********************
+ * raw_alloc
+ ********************/
+static inline void *
+raw_alloc(size_t size)
+{
+    /* chunks come from the application allocator, never from an arena */
+    if (__allocator.malloc)
+        return __allocator.malloc(size, __FILE__, __LINE__, __FUNCTION__);
+    else
+        return malloc(size);
+}
+
+
+/********************
+ * raw_free
+ ********************/
+static inline void
+raw_free(void *ptr)
+{
+    if (__allocator.free)
+        __allocator.free(ptr, __FILE__, __LINE__, __FUNCTION__);
+    else
+        free(ptr);
+}
+
+
+/********************
+ * prolog_set_arena
+ ********************/
+PROLOG_API int
+prolog_set_arena(size_t chunk_size)
+{
+    if (__arena != NULL)
+        return EBUSY;
+
+    if (chunk_size != 0 && chunk_size < ARENA_MIN_CHUNK)
+        chunk_size = ARENA_MIN_CHUNK;
+
+    arena_chunk = ARENA_ALIGNED(chunk_size);
+    return 0;
+}
+
+
+/********************
+ * libprolog_arena_begin
+ ********************/
+int
+libprolog_arena_begin(void)
+{
+    libprolog_arena_t *a;
+
+    if (!arena_chunk)
+        return 0;
+
+    if (__arena != NULL)
+        return EBUSY;
+
+    if ((a = raw_alloc(ARENA_SIZE + arena_chunk)) == NULL)
+        return ENOMEM;
+
+    a->magic       = ARENA_MAGIC;
+    a->root        = NULL;
+    a->chunks      = &a->first;
+    a->first.next  = NULL;
+    a->first.data  = ((char *)a) + ARENA_SIZE;
+    a->first.size  = arena_chunk;
+    a->first.used  = 0;
+
+    __arena = a;
+    return 0;
+}
+
+
+/********************
+ * arena_destroy
+ ********************/
+static void
+arena_destroy(libprolog_arena_t *a)
+{
+    arena_chunk_t *c, *n;
+
+    for (c = a->chunks; c != &a->first; c = n) {
+        n = c->next;
+        raw_free(c);
+    }
+
+    a->magic = 0;
+    raw_free(a);
+}
+
+
+/********************
+ * libprolog_arena_end
+ ********************/
+void
+libprolog_arena_end(int keep)
+{
+    libprolog_arena_t *a = __arena;
+
+    /*
+     * Stop allocating from the current arena. If the evaluation produced
+     * a result the arena is now owned by the result, otherwise get rid of
+     * it right away.
+     */
+
+    __arena = NULL;
+
+    if (a != NULL && (!keep || a->root == NULL))
+        arena_destroy(a);
+}
+
+
+/********************
+ * libprolog_arena_alloc
+ ********************/
+void *
+libprolog_arena_alloc(libprolog_arena_t *a, size_t size)
+{
+    arena_chunk_t *c;
+    size_t         need, csize;
+    char          *p;
+    int            root;
+
+    root = (a->root == NULL);
+    need = (root ? ARENA_LINK : 0) + ARENA_HDR + ARENA_ALIGNED(size);
+    c    = a->chunks;
+
+    if (c->used + need > c->size) {
+        csize = need > arena_chunk ? need : arena_chunk;
+        if ((c = raw_alloc(CHUNK_SIZE + csize)) == NULL)
+            return NULL;
+
+        c->data   = ((char *)c) + CHUNK_SIZE;
+        c->size   = csize;
+        c->used   = 0;
+        c->next   = a->chunks;
+        a->chunks = c;
+    }
+
+    p        = c->data + c->used;
+    c->used += need;
+
+    if (root) {
+        *(libprolog_arena_t **)p = a;
+        p += ARENA_LINK;
+    }
+
+    *(size_t *)p = size;
+    p += ARENA_HDR;
+
+    if (root)
+        a->root = p;
+
+    return p;
+}
+
+
+/********************
+ * libprolog_arena_realloc
+ ********************/
+void *
+libprolog_arena_realloc(libprolog_arena_t *a, void *ptr, size_t size)
+{
+    arena_chunk_t *c = a->chunks;
+    char          *p = ptr;
+    size_t         osize, base;
+    void          *np;
+
+    if (ptr == NULL)
+        return libprolog_arena_alloc(a, size);
+
+    osize = *(size_t *)(p - ARENA_HDR);
+
+    /* grow or shrink the last allocation in place if we can */
+    if (p + ARENA_ALIGNED(osize) == c->data + c->used) {
+        base = c->used - ARENA_ALIGNED(osize);
+        if (base + ARENA_ALIGNED(size) <= c->size) {
+            c->used = base + ARENA_ALIGNED(size);
+            *(size_t *)(p - ARENA_HDR) = size;
+            return ptr;
+        }
+    }
+
+    if (size <= osize)
+        return ptr;
+
+    if ((np = libprolog_arena_alloc(a, size)) != NULL)
+        memcpy(np, ptr, osize);
+
+    return np;
+}
+
+
+/********************
+ * libprolog_arena_free
+ ********************/
+void
+libprolog_arena_free(libprolog_arena_t *a, void *ptr)
+{
+    arena_chunk_t *c = a->chunks;
+    char          *p = ptr;
+    size_t         size;
+
+    /* we can only give back the last allocation of the current chunk */
+    size = *(size_t *)(p - ARENA_HDR);
+    if (p + ARENA_ALIGNED(size) == c->data + c->used && ptr != a->root)
+        c->used -= ARENA_HDR + ARENA_ALIGNED(size);
+}
+
+
+/********************
+ * libprolog_arena_release
+ ********************/
+void
+libprolog_arena_release(void *root)
+{
+    libprolog_arena_t *a;
+
+    a = *(libprolog_arena_t **)(((char *)root) - ARENA_HDR - ARENA_LINK);
+
+    if (a->magic != ARENA_MAGIC || a->root != root) {
+        PROLOG_ERROR("%s: %p is not the root of an arena", __FUNCTION__, root);
+        return;
+    }
+
+    /* the arena being collected into gets destroyed by arena_end */
+    if (a != __arena)
+        arena_destroy(a);
+}
+
+
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
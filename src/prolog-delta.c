@@ -0,0 +1,585 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include <SWI-Stream.h>
+#include <SWI-Prolog.h>
+
+#include <prolog/prolog.h>
+
+#include "libprolog.h"
+
+
+/*
+ * result deltas
+ *
+ * Notes:
+ *     We remember the last successful result of every predicate and
+ *     argument combination evaluated with prolog_acall_delta and compare
+ *     the new result against it. Objects are identified by their name.
+ *     If there are several objects with the same name, they are paired
+ *     up in the order they appear in the results.
+ */
+
+#define OBJECT_NAME "name"
+
+static GHashTable *delta_cache = NULL;       /* previous results */
+
+
+/********************
+ * delta_key
+ ********************/
+static char *
+delta_key(prolog_predicate_t *pred, void **args, int narg)
+{
+    GString *key;
+    int      i, a, type;
+
+    key = g_string_new(NULL);
+    g_string_printf(key, "%s:%s/%d(", pred->module ? pred->module : "",
+                    pred->name, pred->arity);
+
+    for (i = 0, a = 0; i < narg && i < pred->arity - 1; i++) {
+        type = (int)args[a++];
+        switch (type) {
+        case 's':
+            g_string_append_printf(key, "%ss:%s", i ? "," : "",
+                                   (char *)args[a++]);
+            break;
+        case 'i':
+            g_string_append_printf(key, "%si:%d", i ? "," : "",
+                                   (int)args[a++]);
+            break;
+        case 'd':
+            g_string_append_printf(key, "%sd:%.17g", i ? "," : "",
+                                   *(double *)args[a++]);
+            break;
+        default:
+            PROLOG_ERROR("%s: invalid prolog argument type 0x%x",
+                         __FUNCTION__, type);
+            g_string_free(key, TRUE);
+            return NULL;
+        }
+    }
+
+    g_string_append_c(key, ')');
+
+    return g_string_free(key, FALSE);
+}
+
+
+/********************
+ * delta_free_result
+ ********************/
+static void
+delta_free_result(gpointer data)
+{
+    prolog_free_results((char ***)data);
+}
+
+
+/********************
+ * field_find
+ ********************/
+static int
+field_find(char **object, const char *name)
+{
+    int p;
+
+    for (p = 0; object[p] != NULL; p += 3)
+        if (!strcmp(object[p], name))
+            return p;
+
+    return -1;
+}
+
+
+/********************
+ * field_equal
+ ********************/
+static int
+field_equal(char **f1, char **f2)
+{
+    if (f1[1] != f2[1])
+        return FALSE;
+
+    switch ((int)f1[1]) {
+    case 's': return !strcmp(f1[2], f2[2]);
+    case 'i': return f1[2] == f2[2];
+    case 'd': return *(double *)f1[2] == *(double *)f2[2];
+    default:  return FALSE;
+    }
+}
+
+
+/********************
+ * field_copy
+ ********************/
+static int
+field_copy(char **dst, char **src)
+{
+    double *d;
+
+    if ((dst[0] = STRDUP(src[0])) == NULL)
+        return ENOMEM;
+
+    dst[1] = src[1];
+
+    switch ((int)src[1]) {
+    case 's':
+        if ((dst[2] = STRDUP(src[2])) == NULL)
+            return ENOMEM;
+        break;
+    case 'd':
+        if (ALLOC_OBJ(d) == NULL)
+            return ENOMEM;
+        *d     = *(double *)src[2];
+        dst[2] = (char *)d;
+        break;
+    default:
+        dst[2] = src[2];
+        break;
+    }
+
+    return 0;
+}
+
+
+/********************
+ * object_name
+ ********************/
+static const char *
+object_name(char **object)
+{
+    if (object[0] != NULL && !strcmp(object[0], OBJECT_NAME))
+        return object[2];
+    else
+        return "";
+}
+
+
+/********************
+ * object_diff
+ ********************/
+static char **
+object_diff(char **object, char **other, int *err)
+{
+    char **diff;
+    int    n, p, q, d, named;
+
+    /*
+     * Copy the name and every field of object that is either missing
+     * from or different in other. Return NULL if there is no difference.
+     * If other is NULL copy the whole object.
+     */
+
+    for (n = 0; object[n] != NULL; n += 3)
+        ;
+
+    if ((diff = ALLOC_ARRAY(char *, n + 1)) == NULL) {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    d = 0;
+    if (object[0] != NULL && !strcmp(object[0], OBJECT_NAME)) {
+        if ((*err = field_copy(diff, object)) != 0)
+            goto fail;
+        d = 3;
+    }
+    named = d;
+
+    for (p = d; object[p] != NULL; p += 3) {
+        if (other != NULL && (q = field_find(other, object[p])) >= 0 &&
+            field_equal(object + p, other + q))
+            continue;
+
+        if ((*err = field_copy(diff + d, object + p)) != 0)
+            goto fail;
+        d += 3;
+    }
+
+    if (other != NULL && d == named) {
+        *err = 0;
+        goto fail;
+    }
+
+    return diff;
+
+ fail:
+    for (p = 0; diff[p] != NULL; p += 3) {
+        FREE(diff[p]);
+        if (diff[p+1] == (char *)'s' || diff[p+1] == (char *)'d')
+            FREE(diff[p+2]);
+    }
+    FREE(diff);
+    return NULL;
+}
+
+
+/********************
+ * object_copy
+ ********************/
+static char **
+object_copy(char **object, int *err)
+{
+    return object_diff(object, NULL, err);
+}
+
+
+/********************
+ * object_named
+ ********************/
+static char **
+object_named(char **object, int *err)
+{
+    char **named;
+
+    /*
+     * Copy only the name of object, without any of its fields. This is
+     * the other half of a change that only adds or only removes fields.
+     */
+
+    if ((named = ALLOC_ARRAY(char *, 3 + 1)) == NULL) {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    if (object[0] != NULL && !strcmp(object[0], OBJECT_NAME)) {
+        if ((*err = field_copy(named, object)) != 0) {
+            FREE(named[0]);
+            FREE(named[2]);
+            FREE(named);
+            return NULL;
+        }
+    }
+
+    return named;
+}
+
+
+/********************
+ * objects_new
+ ********************/
+static char ***
+objects_new(int n)
+{
+    char ***objects;
+
+    if ((objects = ALLOC_ARRAY(char **, 1 + n + 1)) == NULL)
+        return NULL;
+
+    objects[0] = RESULT_TAG(RESULT_OBJECTS);
+
+    return objects + 1;
+}
+
+
+/********************
+ * objects_count
+ ********************/
+static int
+objects_count(char ***objects)
+{
+    int n = 0;
+
+    if (objects != NULL && RESULT_TYPE(objects[-1]) == RESULT_OBJECTS)
+        while (objects[n] != NULL)
+            n++;
+
+    return n;
+}
+
+
+/********************
+ * objects_trim
+ ********************/
+static char ***
+objects_trim(char ***objects)
+{
+    if (objects != NULL && objects[0] == NULL) {
+        prolog_free_objects(objects);
+        return NULL;
+    }
+    else
+        return objects;
+}
+
+
+/********************
+ * delta_compute
+ ********************/
+static int
+delta_compute(char ***old, char ***new, prolog_delta_t *delta)
+{
+    char **object;
+    int    nold, nnew, i, j, na, nr, nc, err;
+    char  *paired;
+
+    nold = objects_count(old);
+    nnew = objects_count(new);
+
+    if ((paired = ALLOC_ARRAY(char, nold + 1)) == NULL)
+        return ENOMEM;
+
+    delta->added    = objects_new(nnew);
+    delta->removed  = objects_new(nold);
+    delta->changed  = objects_new(nnew);
+    delta->previous = objects_new(nnew);
+
+    if (!delta->added   || !delta->removed ||
+        !delta->changed || !delta->previous) {
+        err = ENOMEM;
+        goto fail;
+    }
+
+    na = nr = nc = 0;
+    err = 0;
+
+    for (i = 0; i < nnew; i++) {
+        for (j = 0; j < nold; j++)
+            if (!paired[j] &&
+                !strcmp(object_name(new[i]), object_name(old[j])))
+                break;
+
+        if (j >= nold) {
+            if ((object = object_copy(new[i], &err)) == NULL)
+                goto fail;
+            delta->added[na++] = object;
+            continue;
+        }
+
+        paired[j] = TRUE;
+
+        /* changed or new fields in the new, changed or gone in the old */
+        if ((object = object_diff(new[i], old[j], &err)) != NULL)
+            delta->changed[nc] = object;
+        else if (err)
+            goto fail;
+
+        if ((object = object_diff(old[j], new[i], &err)) != NULL)
+            delta->previous[nc] = object;
+        else if (err)
+            goto fail;
+
+        if (delta->changed[nc] != NULL || delta->previous[nc] != NULL) {
+            /* keep the two lists paired, fill in the name if needed */
+            if (delta->changed[nc] == NULL)
+                delta->changed[nc] = object_named(new[i], &err);
+            if (delta->previous[nc] == NULL)
+                delta->previous[nc] = object_named(old[j], &err);
+            if (err)
+                goto fail;
+            nc++;
+        }
+    }
+
+    for (j = 0; j < nold; j++) {
+        if (paired[j])
+            continue;
+        if ((object = object_copy(old[j], &err)) == NULL)
+            goto fail;
+        delta->removed[nr++] = object;
+    }
+
+    FREE(paired);
+
+    delta->added    = objects_trim(delta->added);
+    delta->removed  = objects_trim(delta->removed);
+    delta->changed  = objects_trim(delta->changed);
+    delta->previous = objects_trim(delta->previous);
+
+    return 0;
+
+ fail:
+    FREE(paired);
+    prolog_free_delta(delta);
+    return err ? err : ENOMEM;
+}
+
+
+/********************
+ * prolog_acall_delta
+ ********************/
+PROLOG_API int
+prolog_acall_delta(prolog_predicate_t *pred, prolog_delta_t *delta,
+                   void **args, int narg)
+{
+    char   ***result, ***prev;
+    char     *key;
+    int       status, err;
+
+    memset(delta, 0, sizeof(*delta));
+
+    if ((key = delta_key(pred, args, narg)) == NULL)
+        return -EINVAL;
+
+    if (delta_cache == NULL) {
+        delta_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, delta_free_result);
+        if (delta_cache == NULL) {
+            g_free(key);
+            return -ENOMEM;
+        }
+    }
+
+    result = NULL;
+    status = prolog_acall(pred, &result, args, narg);
+
+    if (status <= 0) {
+        if (result != NULL && RESULT_TYPE(result[-1]) == RESULT_EXCEPTION)
+            delta->exception = result;
+        else
+            prolog_free_results(result);
+        g_free(key);
+        return status;
+    }
+
+    prev = g_hash_table_lookup(delta_cache, key);
+
+    if ((err = delta_compute(prev, result, delta)) != 0) {
+        prolog_free_results(result);
+        g_free(key);
+        return -err;
+    }
+
+    g_hash_table_replace(delta_cache, key, result);
+
+    return status;
+}
+
+
+/********************
+ * prolog_free_delta
+ ********************/
+PROLOG_API void
+prolog_free_delta(prolog_delta_t *delta)
+{
+    if (delta == NULL)
+        return;
+
+    prolog_free_objects(delta->added);
+    prolog_free_objects(delta->removed);
+    prolog_free_objects(delta->changed);
+    prolog_free_objects(delta->previous);
+    prolog_free_exception(delta->exception);
+
+    memset(delta, 0, sizeof(*delta));
+}
+
+
+/********************
+ * prolog_dump_delta
+ ********************/
+PROLOG_API void
+prolog_dump_delta(prolog_delta_t *delta)
+{
+    if (delta == NULL)
+        return;
+
+    if (delta->exception != NULL) {
+        prolog_dump_exception(delta->exception);
+        return;
+    }
+
+    if (delta->added != NULL) {
+        printf("added:\n");
+        prolog_dump_objects(delta->added);
+    }
+    if (delta->removed != NULL) {
+        printf("removed:\n");
+        prolog_dump_objects(delta->removed);
+    }
+    if (delta->changed != NULL) {
+        printf("changed:\n");
+        prolog_dump_objects(delta->changed);
+        printf("previously:\n");
+        prolog_dump_objects(delta->previous);
+    }
+}
+
+
+/********************
+ * forget_matching
+ ********************/
+static gboolean
+forget_matching(gpointer key, gpointer value, gpointer data)
+{
+    const char *prefix = (const char *)data;
+
+    (void)value;
+
+    return !strncmp((const char *)key, prefix, strlen(prefix));
+}
+
+
+/********************
+ * prolog_forget_results
+ ********************/
+PROLOG_API void
+prolog_forget_results(prolog_predicate_t *pred)
+{
+    char *prefix;
+
+    if (delta_cache == NULL)
+        return;
+
+    if (pred == NULL) {
+        g_hash_table_remove_all(delta_cache);
+        return;
+    }
+
+    prefix = g_strdup_printf("%s:%s/%d(", pred->module ? pred->module : "",
+                             pred->name, pred->arity);
+    g_hash_table_foreach_remove(delta_cache, forget_matching, prefix);
+    g_free(prefix);
+}
+
+
+/********************
+ * libprolog_delta_exit
+ ********************/
+void
+libprolog_delta_exit(void)
+{
+    if (delta_cache != NULL) {
+        g_hash_table_destroy(delta_cache);
+        delta_cache = NULL;
+    }
+}
+
+
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
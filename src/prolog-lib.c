@@ -177,13 +177,15 @@ prolog_exit(void)
 {
     if (!initialized)
         return;
-    
+
     if (PL_is_initialised(NULL, NULL))
         PL_cleanup(0);
     
     libprolog_free_predicates();
+    libprolog_delta_exit();
 
     libprolog_trace_exit();
+    libprolog_memprof_exit();
     initialized = FALSE;
 }
 
@@ -217,6 +219,9 @@ prolog_set_allocator(prolog_allocator_t *allocator)
 {
     if (initialized)
         return EBUSY;
+
+    if (libprolog_memprof_chain(allocator))
+        return 0;
     
     if ((__allocator.malloc && allocator->malloc != __allocator.malloc) ||
         (__allocator.realloc && allocator->realloc != __allocator.realloc) ||
@@ -0,0 +1,442 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include <SWI-Stream.h>
+#include <SWI-Prolog.h>
+
+#include <prolog/prolog.h>
+
+#include "libprolog.h"
+
+
+/*
+ * allocation profiler
+ *
+ * Notes:
+ *     The profiler installs itself as the library allocator, chaining
+ *     to whatever allocator (if any) was installed before it. Every block
+ *     is prefixed with a small header pointing to the call site it was
+ *     allocated from, so frees can be accounted for without lookups.
+ *     Call sites are keyed by file, line and the rule being evaluated at
+ *     the time of the allocation. Internal bookkeeping is done with plain
+ *     malloc and glib, never through our own allocator hooks.
+ *
+ *     Since blocks carry a header, profiling can only be turned on
+ *     before the library is initialized and turned off once every block
+ *     allocated through it has been freed. We count blocks, not bytes,
+ *     for the latter, as even a zero-sized block has a header.
+ */
+
+#define NO_RULE "-"
+
+typedef struct {
+    const char *file;                        /* source file */
+    int         line;                        /* source line */
+    const char *func;                        /* function */
+    char       *rule;                        /* rule being evaluated */
+    size_t      live;                        /* bytes currently allocated */
+    size_t      peak;                        /* peak of live bytes */
+    size_t      total;                       /* total bytes allocated */
+    int         nalloc;                      /* number of allocations */
+    int         nfree;                       /* number of frees */
+} memsite_t;
+
+typedef union {
+    struct {
+        memsite_t *site;                     /* allocation call site */
+        size_t     size;                     /* requested size */
+    } h;
+    double align;                            /* keep blocks aligned */
+} memhdr_t;
+
+
+static int                 memprof_enabled;  /* profiling on/off */
+static prolog_allocator_t  memprof_next;     /* allocator we chain to */
+static GHashTable         *memprof_sites;    /* call sites */
+static const char         *memprof_rule;     /* rule being evaluated */
+static size_t              memprof_live;     /* total bytes allocated */
+static size_t              memprof_peak;     /* peak of total */
+static size_t              memprof_nblock;   /* blocks allocated */
+
+
+static void *memprof_malloc (size_t, const char *, int, const char *);
+static void *memprof_realloc(void *, size_t, const char *, int, const char *);
+static void  memprof_free   (void *, const char *, int, const char *);
+
+
+/********************
+ * site_hash
+ ********************/
+static guint
+site_hash(gconstpointer key)
+{
+    const memsite_t *s = key;
+
+    return g_str_hash(s->file) ^ (s->line << 8) ^ g_str_hash(s->rule);
+}
+
+
+/********************
+ * site_equal
+ ********************/
+static gboolean
+site_equal(gconstpointer k1, gconstpointer k2)
+{
+    const memsite_t *s1 = k1, *s2 = k2;
+
+    return (s1->line == s2->line &&
+            !strcmp(s1->file, s2->file) && !strcmp(s1->rule, s2->rule));
+}
+
+
+/********************
+ * site_get
+ ********************/
+static memsite_t *
+site_get(const char *file, int line, const char *func)
+{
+    memsite_t key, *s;
+
+    key.file = file;
+    key.line = line;
+    key.rule = (char *)(memprof_rule ? memprof_rule : NO_RULE);
+
+    if ((s = g_hash_table_lookup(memprof_sites, &key)) != NULL)
+        return s;
+
+    if ((s = calloc(1, sizeof(*s))) == NULL)
+        return NULL;
+
+    s->file = file;
+    s->line = line;
+    s->func = func;
+    if ((s->rule = strdup(key.rule)) == NULL) {
+        free(s);
+        return NULL;
+    }
+
+    g_hash_table_insert(memprof_sites, s, s);
+    return s;
+}
+
+
+/********************
+ * site_alloc
+ ********************/
+static inline void
+site_alloc(memsite_t *s, size_t size)
+{
+    if (s != NULL) {
+        s->nalloc++;
+        s->total += size;
+        s->live  += size;
+        if (s->live > s->peak)
+            s->peak = s->live;
+    }
+
+    memprof_nblock++;
+    memprof_live += size;
+    if (memprof_live > memprof_peak)
+        memprof_peak = memprof_live;
+}
+
+
+/********************
+ * site_free
+ ********************/
+static inline void
+site_free(memsite_t *s, size_t size)
+{
+    if (s != NULL) {
+        s->nfree++;
+        s->live -= size;
+    }
+
+    memprof_nblock--;
+    memprof_live -= size;
+}
+
+
+/********************
+ * prolog_set_memprof
+ ********************/
+PROLOG_API int
+prolog_set_memprof(int enable)
+{
+    if (!enable == !memprof_enabled)
+        return 0;
+
+    if (enable) {
+        if (libprolog_initialized())
+            return EBUSY;
+
+        if (memprof_sites == NULL) {
+            memprof_sites = g_hash_table_new(site_hash, site_equal);
+            if (memprof_sites == NULL)
+                return ENOMEM;
+        }
+
+        memprof_next = __allocator;
+
+        __allocator.malloc  = memprof_malloc;
+        __allocator.realloc = memprof_realloc;
+        __allocator.free    = memprof_free;
+    }
+    else {
+        if (memprof_nblock != 0)
+            return EBUSY;
+
+        __allocator = memprof_next;
+    }
+
+    memprof_enabled = enable;
+    return 0;
+}
+
+
+/********************
+ * prolog_memprof_statistics
+ ********************/
+PROLOG_API int
+prolog_memprof_statistics(size_t *live, size_t *peak, int *nsite)
+{
+    if (memprof_sites == NULL)
+        return ENOENT;
+
+    if (live != NULL)
+        *live = memprof_live;
+    if (peak != NULL)
+        *peak = memprof_peak;
+    if (nsite != NULL)
+        *nsite = g_hash_table_size(memprof_sites);
+
+    return 0;
+}
+
+
+/********************
+ * libprolog_memprof_chain
+ ********************/
+int
+libprolog_memprof_chain(prolog_allocator_t *allocator)
+{
+    /* let the application override the allocator underneath us */
+    if (!memprof_enabled)
+        return FALSE;
+
+    memprof_next = *allocator;
+    return TRUE;
+}
+
+
+/********************
+ * libprolog_memprof_rule
+ ********************/
+const char *
+libprolog_memprof_rule(const char *rule)
+{
+    const char *prev = memprof_rule;
+
+    memprof_rule = rule;
+
+    return prev;
+}
+
+
+/********************
+ * memprof_malloc
+ ********************/
+static void *
+memprof_malloc(size_t size, const char *file, int line, const char *func)
+{
+    memhdr_t *hdr;
+    size_t    total = sizeof(*hdr) + size;
+
+    if (memprof_next.malloc)
+        hdr = memprof_next.malloc(total, file, line, func);
+    else
+        hdr = malloc(total);
+
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->h.site = site_get(file, line, func);
+    hdr->h.size = size;
+    site_alloc(hdr->h.site, size);
+
+    return hdr + 1;
+}
+
+
+/********************
+ * memprof_realloc
+ ********************/
+static void *
+memprof_realloc(void *ptr, size_t size,
+                const char *file, int line, const char *func)
+{
+    memhdr_t  *hdr, *nhdr;
+    memsite_t *site;
+    size_t     osize, total = sizeof(*hdr) + size;
+
+    if (ptr == NULL)
+        return memprof_malloc(size, file, line, func);
+
+    hdr   = ((memhdr_t *)ptr) - 1;
+    site  = hdr->h.site;
+    osize = hdr->h.size;
+
+    if (memprof_next.realloc)
+        nhdr = memprof_next.realloc(hdr, total, file, line, func);
+    else
+        nhdr = realloc(hdr, total);
+
+    if (nhdr == NULL)
+        return NULL;
+
+    /* account the old block as freed and the new one to the realloc site */
+    site_free(site, osize);
+    nhdr->h.site = site_get(file, line, func);
+    nhdr->h.size = size;
+    site_alloc(nhdr->h.site, size);
+
+    return nhdr + 1;
+}
+
+
+/********************
+ * memprof_free
+ ********************/
+static void
+memprof_free(void *ptr, const char *file, int line, const char *func)
+{
+    memhdr_t *hdr;
+
+    if (ptr == NULL)
+        return;
+
+    hdr = ((memhdr_t *)ptr) - 1;
+    site_free(hdr->h.site, hdr->h.size);
+
+    if (memprof_next.free)
+        memprof_next.free(hdr, file, line, func);
+    else
+        free(hdr);
+}
+
+
+/********************
+ * site_cmp
+ ********************/
+static int
+site_cmp(const void *p1, const void *p2)
+{
+    const memsite_t *s1 = *(memsite_t **)p1, *s2 = *(memsite_t **)p2;
+
+    /* sort by peak usage, then by total allocated */
+    if (s1->peak != s2->peak)
+        return s1->peak < s2->peak ? 1 : -1;
+    if (s1->total != s2->total)
+        return s1->total < s2->total ? 1 : -1;
+
+    return s2->nalloc - s1->nalloc;
+}
+
+
+/********************
+ * prolog_dump_memprof
+ ********************/
+PROLOG_API void
+prolog_dump_memprof(void)
+{
+    GHashTableIter   it;
+    gpointer         key, value;
+    memsite_t      **sites;
+    int              nsite, i;
+
+    if (memprof_sites == NULL)
+        return;
+
+    nsite = g_hash_table_size(memprof_sites);
+    if ((sites = malloc(nsite * sizeof(*sites))) == NULL)
+        return;
+
+    i = 0;
+    g_hash_table_iter_init(&it, memprof_sites);
+    while (g_hash_table_iter_next(&it, &key, &value))
+        sites[i++] = value;
+
+    qsort(sites, nsite, sizeof(*sites), site_cmp);
+
+    PROLOG_INFO("memory profile: %zu bytes live, %zu bytes peak, %d sites",
+                memprof_live, memprof_peak, nsite);
+    PROLOG_INFO("%-24s %-32s %8s %8s %10s %7s %7s", "rule", "call site",
+                "live", "peak", "total", "allocs", "frees");
+
+    for (i = 0; i < nsite; i++) {
+        char site[64];
+
+        snprintf(site, sizeof(site), "%s@%s:%d",
+                 sites[i]->func, sites[i]->file, sites[i]->line);
+        PROLOG_INFO("%-24s %-32s %8zu %8zu %10zu %7d %7d", sites[i]->rule,
+                    site, sites[i]->live, sites[i]->peak, sites[i]->total,
+                    sites[i]->nalloc, sites[i]->nfree);
+    }
+
+    free(sites);
+}
+
+
+/********************
+ * libprolog_memprof_exit
+ ********************/
+void
+libprolog_memprof_exit(void)
+{
+    /*
+     * Notes:
+     *     We intentionally keep the call sites around. Blocks allocated
+     *     before exit (eg. results not freed yet) still point to them.
+     */
+
+    if (memprof_enabled)
+        prolog_dump_memprof();
+}
+
+
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
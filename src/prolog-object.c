@@ -207,7 +207,7 @@ libprolog_collect_exception(qid_t qid, void *retval)
         else
             error = STRDUP("unknown prolog exception");
         
-        objects[0] = (char **)RESULT_EXCEPTION;
+        objects[0] = RESULT_TAG(RESULT_EXCEPTION);
         objects[1] = (char **)error;
         objects[2] = NULL;
 
@@ -244,7 +244,7 @@ libprolog_collect_result(term_t pl_retval, void *retval)
         if ((objects = ALLOC_ARRAY(char **, 1 + n + 1)) == NULL)
             return -ENOMEM;
             
-        *objects++ = (char **)RESULT_OBJECTS;
+        *objects++ = RESULT_TAG(RESULT_OBJECTS);
         
         if (swi_list_walk(pl_retval, collect_objects, objects)) {
             prolog_free_objects(objects);
@@ -274,11 +274,16 @@ prolog_free_objects(char ***objects)
     if (objects == NULL)
         return;
 
-    if (objects[-1] != (char **)RESULT_OBJECTS) {
+    if (RESULT_TYPE(objects[-1]) != RESULT_OBJECTS) {
         PROLOG_WARNING("%s: called for invalid list (tag: 0x%x)",
                        __FUNCTION__, (int)objects[-1]);
         return;
     }
+
+    if ((int)objects[-1] & RESULT_ARENA) {
+        libprolog_arena_release(objects - 1);
+        return;
+    }
     
     for (i = 0; objects[i]; i++) {
         for (p = 0; objects[i][p]; p += 3) {
@@ -309,7 +314,7 @@ prolog_dump_objects(char ***objects)
     if (objects == NULL)
         return;
 
-    if (objects[-1] != (char **)RESULT_OBJECTS) {
+    if (RESULT_TYPE(objects[-1]) != RESULT_OBJECTS) {
         PROLOG_WARNING("%s: called for invalid list (tag: 0x%x)",
                        __FUNCTION__, (int)objects[-1]);
         return;
@@ -354,7 +359,7 @@ prolog_dump_exception(char ***exception)
     if (exception == NULL)
         return;
     
-    if (exception[-1] != (char **)RESULT_EXCEPTION) {
+    if (RESULT_TYPE(exception[-1]) != RESULT_EXCEPTION) {
         PROLOG_WARNING("%s: called for invalid list (tag: 0x%x)",
                        __FUNCTION__, (int)exception[-1]);
         return;
@@ -373,12 +378,17 @@ prolog_free_exception(char ***exception)
     if (exception == NULL)
         return;
 
-    if (exception[-1] != (char **)RESULT_EXCEPTION) {
+    if (RESULT_TYPE(exception[-1]) != RESULT_EXCEPTION) {
         PROLOG_WARNING("%s: called for invalid list (tag: 0x%x)",
                        __FUNCTION__, (int)exception[-1]);
         return;
     }
 
+    if ((int)exception[-1] & RESULT_ARENA) {
+        libprolog_arena_release(exception - 1);
+        return;
+    }
+
     FREE((char *)exception[0]);
     FREE(exception - 1);
 }
@@ -395,7 +405,7 @@ prolog_free_results(char ***results)
     if (results == NULL)
         return;
 
-    switch ((tag = (int)results[-1])) {
+    switch ((tag = RESULT_TYPE(results[-1]))) {
     case RESULT_OBJECTS:   prolog_free_objects(results);   break;
     case RESULT_EXCEPTION: prolog_free_exception(results); break;
     default:
@@ -416,7 +426,7 @@ prolog_dump_results(char ***results)
     if (results == NULL)
         return;
 
-    switch ((tag = (int)results[-1])) {
+    switch ((tag = RESULT_TYPE(results[-1]))) {
     case RESULT_OBJECTS:   prolog_dump_objects(results);   break;
     case RESULT_EXCEPTION: prolog_dump_exception(results); break;
     default:
@@ -0,0 +1,687 @@
+/*************************************************************************
+This file is part of libprolog
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include <SWI-Stream.h>
+#include <SWI-Prolog.h>
+
+#include <prolog/prolog.h>
+
+#include "libprolog.h"
+
+
+/*
+ * packed results
+ *
+ * Notes:
+ *     A packed result is a single flat buffer with no pointers in it, so
+ *     it can be copied, sent over a socket or put in shared memory as is.
+ *     Everything is referred to by its offset from the start of the buffer.
+ *     The buffer starts with a header and a table of object offsets. Each
+ *     object is a field count followed by a table of fixed size fields.
+ *     Field names and string values are NUL-terminated strings appended
+ *     as they are collected. Values are stored in native byte order.
+ *
+ *     The collector writes directly into the buffer. If the buffer turns
+ *     out to be too small collection continues without writing so that
+ *     the caller can learn the amount of space needed.
+ */
+
+#define OBJECT_NAME     "name"
+
+#define PACKED_MAGIC    0x4b504c50U                  /* 'PLPK' */
+#define PACKED_VERSION  1
+#define PACKED_ALIGNED(n) (((n) + PACKED_ALIGN - 1) & ~(PACKED_ALIGN - 1))
+
+typedef struct {
+    uint32_t magic;                          /* PACKED_MAGIC */
+    uint16_t version;                        /* PACKED_VERSION */
+    uint16_t type;                           /* RESULT_OBJECTS/EXCEPTION */
+    uint32_t size;                           /* total size of the buffer */
+    uint32_t error;                          /* exception string */
+    uint32_t nobject;                        /* number of objects */
+    uint32_t objects[0];                     /* object offsets */
+} packed_header_t;
+
+typedef struct {
+    uint32_t name;                           /* field name string */
+    uint32_t type;                           /* 's', 'i' or 'd' */
+    union {
+        uint32_t s;                          /* string offset */
+        int32_t  i;                          /* integer value */
+        double   d;                          /* double value */
+    } value;
+} packed_field_t;
+
+typedef struct {
+    uint32_t       nfield;                   /* number of fields */
+    uint32_t       unused;
+    packed_field_t fields[0];                /* fields */
+} packed_object_t;
+
+typedef struct {
+    libprolog_pack_t *pack;                  /* buffer being packed */
+    size_t            fields;                /* fields of current object */
+    size_t            prev;                  /* fields of previous object */
+    uint32_t          nprev;                 /* number of previous fields */
+} pack_context_t;
+
+
+#define HEADER(buf) ((const packed_header_t *)(buf))
+#define AT(buf, offs, type) ((type *)(((char *)(buf)) + (offs)))
+
+
+/********************
+ * pack_alloc
+ ********************/
+static size_t
+pack_alloc(libprolog_pack_t *pack, size_t size, int align)
+{
+    size_t offs;
+
+    offs = align ? PACKED_ALIGNED(pack->used) : pack->used;
+    pack->used = offs + size;
+
+    return offs;
+}
+
+
+/********************
+ * pack_ptr
+ ********************/
+static inline void *
+pack_ptr(libprolog_pack_t *pack, size_t offs, size_t size)
+{
+    /* only hand out space that actually fits in the buffer */
+    if (offs + size > pack->size)
+        return NULL;
+    else
+        return pack->buf + offs;
+}
+
+
+/********************
+ * pack_string
+ ********************/
+static uint32_t
+pack_string(libprolog_pack_t *pack, const char *str)
+{
+    size_t  len  = strlen(str) + 1;
+    size_t  offs = pack_alloc(pack, len, FALSE);
+    char   *p;
+
+    if ((p = pack_ptr(pack, offs, len)) != NULL)
+        memcpy(p, str, len);
+
+    return (uint32_t)offs;
+}
+
+
+/********************
+ * pack_name
+ ********************/
+static uint32_t
+pack_name(pack_context_t *ctx, int i, const char *name)
+{
+    libprolog_pack_t *pack = ctx->pack;
+    packed_field_t   *prev;
+    const char       *pname;
+    size_t            len;
+
+    /*
+     * Objects of a result usually have the same shape. If the previous
+     * object had the same field name at the same position, share it.
+     */
+
+    if (ctx->prev && i < (int)ctx->nprev) {
+        prev = pack_ptr(pack, ctx->prev + i * sizeof(*prev), sizeof(*prev));
+        len  = strlen(name) + 1;
+        if (prev != NULL && prev->name + len <= pack->size) {
+            pname = AT(pack->buf, prev->name, const char);
+            if (!memcmp(pname, name, len))
+                return prev->name;
+        }
+    }
+
+    return pack_string(pack, name);
+}
+
+
+/********************
+ * pack_field
+ ********************/
+static int
+pack_field(term_t item, int i, void *data)
+{
+    pack_context_t *ctx  = (pack_context_t *)data;
+    packed_field_t *f, field;
+    term_t          pl_field, pl_value;
+    char           *name, *value;
+    size_t          dummy;
+    int             integer;
+
+    memset(&field, 0, sizeof(field));
+
+    if (i == 0) {
+        if (!PL_get_chars(item, &value, CVT_ALL))
+            return EINVAL;
+
+        field.name    = pack_name(ctx, i, OBJECT_NAME);
+        field.type    = 's';
+        field.value.s = pack_string(ctx->pack, value);
+    }
+    else {
+        pl_field = PL_new_term_refs(2);
+        pl_value = pl_field + 1;
+
+        if (!PL_get_list(item, pl_field, pl_value) ||
+            !PL_get_head(pl_value, pl_value) ||
+            !PL_get_chars(pl_field, &name, CVT_ALL))
+            return EINVAL;
+
+        field.name = pack_name(ctx, i, name);
+
+        switch (PL_term_type(pl_value)) {
+        case PL_ATOM:
+            if (!PL_get_atom_chars(pl_value, &value))
+                return EINVAL;
+            field.type    = 's';
+            field.value.s = pack_string(ctx->pack, value);
+            break;
+        case PL_STRING:
+            if (!PL_get_string_chars(pl_value, &value, &dummy))
+                return EINVAL;
+            field.type    = 's';
+            field.value.s = pack_string(ctx->pack, value);
+            break;
+        case PL_INTEGER:
+            if (!PL_get_integer(pl_value, &integer))
+                return EINVAL;
+            field.type    = 'i';
+            field.value.i = integer;
+            break;
+        case PL_FLOAT:
+            field.type = 'd';
+            if (!PL_get_float(pl_value, &field.value.d))
+                return EINVAL;
+            break;
+        default:
+            PROLOG_ERROR("%s: invalid prolog type (%d) for object field",
+                         __FUNCTION__, PL_term_type(pl_value));
+            return EINVAL;
+        }
+    }
+
+    if ((f = pack_ptr(ctx->pack, ctx->fields + i * sizeof(*f),
+                      sizeof(*f))) != NULL)
+        *f = field;
+
+    return 0;
+}
+
+
+/********************
+ * pack_object
+ ********************/
+static int
+pack_object(term_t item, int i, void *data)
+{
+    pack_context_t   *ctx  = (pack_context_t *)data;
+    libprolog_pack_t *pack = ctx->pack;
+    packed_object_t  *obj;
+    uint32_t         *offsp;
+    size_t            offs;
+    int               n, err;
+
+    if ((n = swi_list_length(item)) < 0)
+        return EINVAL;
+
+    offs = pack_alloc(pack, sizeof(*obj) + n * sizeof(packed_field_t), TRUE);
+
+    if ((obj = pack_ptr(pack, offs, sizeof(*obj))) != NULL)
+        obj->nfield = n;
+
+    offsp = pack_ptr(pack, offsetof(packed_header_t, objects[i]),
+                     sizeof(*offsp));
+    if (offsp != NULL)
+        *offsp = (uint32_t)offs;
+
+    ctx->fields = offs + offsetof(packed_object_t, fields);
+
+    if (n > 0 && (err = swi_list_walk(item, pack_field, ctx)) != 0)
+        return err;
+
+    ctx->prev  = ctx->fields;
+    ctx->nprev = n;
+
+    return 0;
+}
+
+
+/********************
+ * pack_finish
+ ********************/
+static int
+pack_finish(libprolog_pack_t *pack, int type, uint32_t error, int nobject)
+{
+    packed_header_t *hdr;
+
+    pack->used = PACKED_ALIGNED(pack->used);
+
+    if (pack->used > pack->size)
+        return ENOSPC;
+
+    if (pack->used > UINT32_MAX)
+        return EOVERFLOW;
+
+    hdr = (packed_header_t *)pack->buf;
+    hdr->magic   = PACKED_MAGIC;
+    hdr->version = PACKED_VERSION;
+    hdr->type    = type;
+    hdr->size    = (uint32_t)pack->used;
+    hdr->error   = error;
+    hdr->nobject = nobject;
+
+    return 0;
+}
+
+
+/********************
+ * libprolog_pack_result
+ ********************/
+int
+libprolog_pack_result(term_t pl_retval, libprolog_pack_t *pack)
+{
+    pack_context_t ctx;
+    int            n, err;
+
+    pack->used = 0;
+
+    switch (PL_term_type(pl_retval)) {
+    case PL_VARIABLE:
+        n = 0;
+        pack_alloc(pack, sizeof(packed_header_t), TRUE);
+        break;
+
+    case PL_ATOM:                                    /* [] is an atom... */
+    case PL_TERM:
+        if (!PL_is_list(pl_retval))
+            goto invalid;
+
+        if ((n = swi_list_length(pl_retval)) < 0)
+            return -EIO;
+
+        pack_alloc(pack, sizeof(packed_header_t) + n * sizeof(uint32_t), TRUE);
+
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.pack = pack;
+
+        if (swi_list_walk(pl_retval, pack_object, &ctx) != 0)
+            return -EIO;
+        break;
+
+    invalid:
+    default:
+        PROLOG_WARNING("%s: cannot handle non-list term type %d", __FUNCTION__,
+                       PL_term_type(pl_retval));
+        return -EINVAL;
+    }
+
+    if ((err = pack_finish(pack, RESULT_OBJECTS, 0, n)) != 0)
+        return -err;
+
+    return TRUE;
+}
+
+
+/********************
+ * libprolog_pack_exception
+ ********************/
+int
+libprolog_pack_exception(qid_t qid, libprolog_pack_t *pack)
+{
+    term_t    pl_error;
+    char     *error;
+    uint32_t  offs;
+    int       err;
+
+    pack->used = 0;
+    error      = NULL;
+
+    if ((pl_error = PL_exception(qid)) == 0)
+        return FALSE;
+
+    PL_get_chars(pl_error, &error, CVT_WRITE | BUF_DISCARDABLE);
+
+    if (!error || !error[0])
+        error = "unknown prolog exception";
+
+    pack_alloc(pack, sizeof(packed_header_t), TRUE);
+    offs = pack_string(pack, error);
+
+    if ((err = pack_finish(pack, RESULT_EXCEPTION, offs, 0)) != 0)
+        return -err;
+
+    return -ECANCELED;
+}
+
+
+/********************
+ * check_string
+ ********************/
+static int
+check_string(const void *buf, size_t size, uint32_t offs)
+{
+    return offs < size && memchr(AT(buf, offs, const char), '\0',
+                                 size - offs) != NULL;
+}
+
+
+/********************
+ * prolog_packed_check
+ ********************/
+PROLOG_API int
+prolog_packed_check(const void *buf, size_t size)
+{
+    const packed_header_t *hdr = HEADER(buf);
+    const packed_object_t *obj;
+    const packed_field_t  *f;
+    uint32_t               i, j, offs;
+
+    /*
+     * Notes:
+     *     The accessors below trust the buffer they are given. Buffers
+     *     received from untrusted sources should be checked here once.
+     */
+
+    if (buf == NULL || ((uintptr_t)buf & (PACKED_ALIGN - 1)))
+        return EINVAL;
+
+    if (size < sizeof(*hdr) || hdr->magic != PACKED_MAGIC)
+        return EINVAL;
+
+    if (hdr->version != PACKED_VERSION)
+        return ENOTSUP;
+
+    if (hdr->size > size)
+        return EINVAL;
+    size = hdr->size;
+
+    switch (hdr->type) {
+    case RESULT_EXCEPTION:
+        return check_string(buf, size, hdr->error) ? 0 : EINVAL;
+    case RESULT_OBJECTS:
+        break;
+    default:
+        return EINVAL;
+    }
+
+    if (hdr->nobject > (size - sizeof(*hdr)) / sizeof(uint32_t))
+        return EINVAL;
+
+    for (i = 0; i < hdr->nobject; i++) {
+        offs = hdr->objects[i];
+        if (offs & (PACKED_ALIGN - 1) || offs > size - sizeof(*obj))
+            return EINVAL;
+        obj = AT(buf, offs, const packed_object_t);
+        if (obj->nfield > (size - offs - sizeof(*obj)) / sizeof(*f))
+            return EINVAL;
+
+        for (j = 0, f = obj->fields; j < obj->nfield; j++, f++) {
+            if (!check_string(buf, size, f->name))
+                return EINVAL;
+            switch (f->type) {
+            case 's':
+                if (!check_string(buf, size, f->value.s))
+                    return EINVAL;
+                break;
+            case 'i':
+            case 'd':
+                break;
+            default:
+                return EINVAL;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/********************
+ * prolog_packed_size
+ ********************/
+PROLOG_API size_t
+prolog_packed_size(const void *buf)
+{
+    return HEADER(buf)->size;
+}
+
+
+/********************
+ * prolog_packed_exception
+ ********************/
+PROLOG_API const char *
+prolog_packed_exception(const void *buf)
+{
+    const packed_header_t *hdr = HEADER(buf);
+
+    if (hdr->type != RESULT_EXCEPTION)
+        return NULL;
+    else
+        return AT(buf, hdr->error, const char);
+}
+
+
+/********************
+ * prolog_packed_count
+ ********************/
+PROLOG_API int
+prolog_packed_count(const void *buf)
+{
+    return (int)HEADER(buf)->nobject;
+}
+
+
+/********************
+ * packed_object
+ ********************/
+static inline const packed_object_t *
+packed_object(const void *buf, int obj)
+{
+    const packed_header_t *hdr = HEADER(buf);
+
+    if (obj < 0 || (uint32_t)obj >= hdr->nobject)
+        return NULL;
+    else
+        return AT(buf, hdr->objects[obj], const packed_object_t);
+}
+
+
+/********************
+ * packed_field
+ ********************/
+static inline const packed_field_t *
+packed_field(const void *buf, int obj, int field)
+{
+    const packed_object_t *o = packed_object(buf, obj);
+
+    if (o == NULL || field < 0 || (uint32_t)field >= o->nfield)
+        return NULL;
+    else
+        return o->fields + field;
+}
+
+
+/********************
+ * prolog_packed_nfield
+ ********************/
+PROLOG_API int
+prolog_packed_nfield(const void *buf, int obj)
+{
+    const packed_object_t *o = packed_object(buf, obj);
+
+    return o ? (int)o->nfield : -1;
+}
+
+
+/********************
+ * prolog_packed_lookup
+ ********************/
+PROLOG_API int
+prolog_packed_lookup(const void *buf, int obj, const char *name)
+{
+    const packed_object_t *o = packed_object(buf, obj);
+    uint32_t               i;
+
+    if (o == NULL)
+        return -1;
+
+    for (i = 0; i < o->nfield; i++)
+        if (!strcmp(AT(buf, o->fields[i].name, const char), name))
+            return (int)i;
+
+    return -1;
+}
+
+
+/********************
+ * prolog_packed_name
+ ********************/
+PROLOG_API const char *
+prolog_packed_name(const void *buf, int obj, int field)
+{
+    const packed_field_t *f = packed_field(buf, obj, field);
+
+    return f ? AT(buf, f->name, const char) : NULL;
+}
+
+
+/********************
+ * prolog_packed_type
+ ********************/
+PROLOG_API int
+prolog_packed_type(const void *buf, int obj, int field)
+{
+    const packed_field_t *f = packed_field(buf, obj, field);
+
+    return f ? (int)f->type : 0;
+}
+
+
+/********************
+ * prolog_packed_string
+ ********************/
+PROLOG_API const char *
+prolog_packed_string(const void *buf, int obj, int field)
+{
+    const packed_field_t *f = packed_field(buf, obj, field);
+
+    if (f == NULL || f->type != 's')
+        return NULL;
+    else
+        return AT(buf, f->value.s, const char);
+}
+
+
+/********************
+ * prolog_packed_integer
+ ********************/
+PROLOG_API int
+prolog_packed_integer(const void *buf, int obj, int field)
+{
+    const packed_field_t *f = packed_field(buf, obj, field);
+
+    return f && f->type == 'i' ? f->value.i : 0;
+}
+
+
+/********************
+ * prolog_packed_double
+ ********************/
+PROLOG_API double
+prolog_packed_double(const void *buf, int obj, int field)
+{
+    const packed_field_t *f = packed_field(buf, obj, field);
+
+    return f && f->type == 'd' ? f->value.d : 0.0;
+}
+
+
+/********************
+ * prolog_dump_packed
+ ********************/
+PROLOG_API void
+prolog_dump_packed(const void *buf)
+{
+    const char *error, *t;
+    int         n, i, p, nfield;
+
+    if (buf == NULL)
+        return;
+
+    if ((error = prolog_packed_exception(buf)) != NULL) {
+        printf("prolog exception '%s'\n", error);
+        return;
+    }
+
+    n = prolog_packed_count(buf);
+    for (i = 0; i < n; i++) {
+        nfield = prolog_packed_nfield(buf, i);
+        p = 0;
+        if (nfield > 0 && !strcmp(prolog_packed_name(buf, i, 0), OBJECT_NAME)) {
+            printf("%s: ", prolog_packed_string(buf, i, 0));
+            p = 1;
+        }
+
+        printf("{ ");
+        t = "";
+        for (; p < nfield; p++) {
+            printf("%s%s: ", t, prolog_packed_name(buf, i, p));
+            switch (prolog_packed_type(buf, i, p)) {
+            case 's': printf("'%s'", prolog_packed_string(buf, i, p)); break;
+            case 'i': printf("%d", prolog_packed_integer(buf, i, p));  break;
+            case 'd': printf("%f", prolog_packed_double(buf, i, p));   break;
+            default:  printf("<unknown>");                             break;
+            }
+            t = ", ";
+        }
+        printf(" }\n");
+    }
+}
+
+
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:set expandtab shiftwidth=4:
+ */
@@ -311,23 +311,41 @@ timeval_add(struct timeval *a, struct timeval *b, struct timeval *sum)
 
 
 static int
-eval_predicate(int flags, prolog_predicate_t *pred, void *retval, term_t args)
+eval_predicate(int flags, prolog_predicate_t *pred, void *retval, term_t args,
+               libprolog_pack_t *pack)
 {
     struct rusage start, diff;
     qid_t         qid;
     term_t        pl_retval = args + pred->arity - 1;
+    const char   *prev;
     int           status;
 
+    prev   = libprolog_memprof_rule(pred->name);
     qid    = PL_open_query(NULL, flags, pred->predicate, args);
     getrusage(RUSAGE_SELF, &start);
     status = PL_next_solution(qid);
     getrusage(RUSAGE_SELF, &diff);
 
-    if (!status)
-        status = libprolog_collect_exception(qid, retval);
-    else
-        status = libprolog_collect_result(pl_retval, retval);
+    if (pack != NULL) {
+        if (!status)
+            status = libprolog_pack_exception(qid, pack);
+        else
+            status = libprolog_pack_result(pl_retval, pack);
+    }
+    else {
+        if (libprolog_arena_begin() != 0)
+            PROLOG_WARNING("%s: failed to set up arena for %s", __FUNCTION__,
+                           pred->name);
+
+        if (!status)
+            status = libprolog_collect_exception(qid, retval);
+        else
+            status = libprolog_collect_result(pl_retval, retval);
+
+        libprolog_arena_end(*(void **)retval != NULL);
+    }
     PL_close_query(qid);
+    libprolog_memprof_rule(prev);
 
     if (status > 0) {
         timeval_sub(&diff.ru_utime, &start.ru_utime, &diff.ru_utime);
@@ -343,10 +361,11 @@ eval_predicate(int flags, prolog_predicate_t *pred, void *retval, term_t args)
 
 
 /********************
- * prolog_acall
+ * acall
  ********************/
-PROLOG_API int
-prolog_acall(prolog_predicate_t *pred, void *retval, void **args, int narg)
+static int
+acall(prolog_predicate_t *pred, void *retval, libprolog_pack_t *pack,
+      void **args, int narg)
 {
     fid_t   frame;
     term_t  pl_args;
@@ -385,7 +404,7 @@ prolog_acall(prolog_predicate_t *pred, void *retval, void **args, int narg)
     else
         flags = NORMAL_QUERY_FLAGS;
 
-    status = eval_predicate(flags, pred, retval, pl_args);
+    status = eval_predicate(flags, pred, retval, pl_args, pack);
 
     if (libprolog_tracing())
         swi_set_trace(FALSE);
@@ -397,6 +416,50 @@ prolog_acall(prolog_predicate_t *pred, void *retval, void **args, int narg)
 } 
 
 
+/********************
+ * prolog_acall
+ ********************/
+PROLOG_API int
+prolog_acall(prolog_predicate_t *pred, void *retval, void **args, int narg)
+{
+    return acall(pred, retval, NULL, args, narg);
+}
+
+
+/********************
+ * prolog_acall_packed
+ ********************/
+PROLOG_API int
+prolog_acall_packed(prolog_predicate_t *pred, void *buf, size_t *size,
+                    void **args, int narg)
+{
+    libprolog_pack_t pack;
+    int              status;
+
+    /*
+     * Notes:
+     *     Like prolog_acall but the result (or exception) is packed into
+     *     the given buffer. On return *size is set to the amount of the
+     *     buffer used. If the buffer is too small -ENOSPC is returned and
+     *     *size is set to the amount of space needed. An exception is
+     *     reported as -ECANCELED, to tell it apart from the -EINVAL of
+     *     invalid arguments.
+     */
+
+    if (size == NULL || ((unsigned long)buf & (PACKED_ALIGN - 1)))
+        return -EINVAL;
+
+    pack.buf  = buf;
+    pack.size = buf ? *size : 0;
+    pack.used = 0;
+
+    status = acall(pred, NULL, &pack, args, narg);
+
+    *size = pack.used;
+    return status;
+}
+
+
 /********************
  * prolog_call
  ********************/
@@ -424,7 +487,7 @@ prolog_call(prolog_predicate_t *pred, void *retval, ...)
     }
     va_end(ap);
 
-    status = eval_predicate(NORMAL_QUERY_FLAGS, pred, retval, pl_args);
+    status = eval_predicate(NORMAL_QUERY_FLAGS, pred, retval, pl_args, NULL);
 
     PL_discard_foreign_frame(frame);
     
@@ -456,7 +519,7 @@ prolog_vcall(prolog_predicate_t *pred, void *retval, va_list ap)
         PL_put_atom_chars(pl_args + i, arg);
     }
 
-    status = eval_predicate(NORMAL_QUERY_FLAGS, pred, retval, pl_args);
+    status = eval_predicate(NORMAL_QUERY_FLAGS, pred, retval, pl_args, NULL);
 
     PL_discard_foreign_frame(frame);
     
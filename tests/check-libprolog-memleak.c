@@ -24,6 +24,7 @@ USA.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <prolog/prolog.h>
 #include <check.h>
 
@@ -92,6 +93,14 @@ setup(void)
 }
 
 
+static void
+setup_memprof(void)
+{
+    fail_unless(prolog_set_memprof(TRUE) == 0);
+    setup();
+}
+
+
 static void
 teardown(void)
 {
@@ -265,6 +274,48 @@ START_TEST(string_argument)
 END_TEST
 
 
+START_TEST(memory_profile)
+{
+    prolog_predicate_t   *pred;
+    char               ***result;
+    size_t                live, peak, base;
+    int                   nsite, i;
+
+    pred = find_predicate(predicates, "predicates", "success", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:success/1.");
+
+    result = NULL;
+    fail_unless(prolog_acall(pred, &result, NULL, 0) == TRUE);
+    fail_unless(result != NULL);
+
+    /* the results are accounted for while they are alive */
+    fail_unless(prolog_memprof_statistics(&live, &peak, &nsite) == 0);
+    fail_unless(nsite > 0);
+    fail_unless(live > 0 && peak >= live);
+
+    prolog_free_results(result);
+    fail_unless(prolog_memprof_statistics(&base, NULL, NULL) == 0);
+    fail_unless(base < live);
+
+    /* repeated calls reuse the call sites and free what they allocate */
+    for (i = 0; i < 4; i++) {
+        result = NULL;
+        fail_unless(prolog_acall(pred, &result, NULL, 0) == TRUE);
+        fail_unless(result != NULL);
+        prolog_free_results(result);
+    }
+
+    fail_unless(prolog_memprof_statistics(&live, &peak, &i) == 0);
+    fail_unless(i == nsite);
+    fail_unless(live == base);
+
+    prolog_dump_memprof();
+
+    /* the predicate table is still allocated through the profiler */
+    fail_unless(prolog_set_memprof(FALSE) == EBUSY);
+}
+END_TEST
+
 
 
 
@@ -287,6 +338,11 @@ chkprolog_leak_tests(Suite *suite)
     tcase_add_test(tc, string_argument);
 
     suite_add_tcase(suite, tc);
+
+    tc = tcase_create("memprof");
+    tcase_add_checked_fixture(tc, setup_memprof, teardown);
+    tcase_add_test(tc, memory_profile);
+    suite_add_tcase(suite, tc);
 }
 
 
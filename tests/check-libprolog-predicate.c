@@ -24,6 +24,7 @@ USA.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <prolog/prolog.h>
 #include <check.h>
 
@@ -52,6 +53,22 @@ teardown(void)
 }
 
 
+static void
+setup_arena(void)
+{
+    fail_unless(prolog_set_arena(512) == 0);
+    setup();
+}
+
+
+static void
+teardown_arena(void)
+{
+    teardown();
+    fail_unless(prolog_set_arena(0) == 0);
+}
+
+
 static prolog_predicate_t *
 find_predicate(prolog_predicate_t *predlist,
                const char *module, const char *name, int arity)
@@ -218,6 +235,210 @@ END_TEST
 
 
 
+START_TEST(arena_results)
+{
+    prolog_predicate_t   *pred;
+    void                 *args[] = { (void *)'s', (void *)"3.141" };
+    int                   narg = 1, i;
+    char               ***result;
+
+    pred = find_predicate(predicates, "predicates", "echo", 2);
+    fail_unless(pred != NULL, "Failed to find predicates:echo/2.");
+
+    for (i = 0; i < 16; i++) {
+        result = NULL;
+        fail_unless(prolog_acall(pred, &result, args, narg) > 0);
+        fail_unless(result != NULL);
+        fail_unless(result[0] != NULL && 
+                    (int)result[0][4] == 's' &&
+                    !strcmp((char *)result[0][5], "3.141"));
+        prolog_free_results(result);
+    }
+}
+END_TEST
+
+
+START_TEST(arena_large_results)
+{
+    prolog_predicate_t   *pred;
+    char               ***result;
+    int                   i, n;
+
+    pred = find_predicate(predicates, "predicates", "many", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:many/1.");
+
+    /* the result array alone is larger than a 512-byte chunk */
+    for (i = 0; i < 4; i++) {
+        result = NULL;
+        fail_unless(prolog_acall(pred, &result, NULL, 0) > 0);
+        fail_unless(result != NULL);
+        for (n = 0; result[n] != NULL; n++)
+            fail_unless((int)result[n][4] == 'i' &&
+                        (int)result[n][5] == n + 1);
+        fail_unless(n == 200);
+        prolog_free_results(result);
+    }
+}
+END_TEST
+
+
+START_TEST(arena_exception)
+{
+    prolog_predicate_t   *pred;
+    char               ***result;
+
+    pred = find_predicate(predicates, "predicates", "exception", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:exception/1.");
+
+    result = NULL;
+    fail_unless(prolog_acall(pred, &result, NULL, 0) < 0);
+    fail_unless(result != NULL);
+
+    prolog_dump_results(result);
+    prolog_free_results(result);
+
+    pred = find_predicate(predicates, "predicates", "failure", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:failure/1.");
+
+    result = NULL;
+    fail_unless(prolog_acall(pred, &result, NULL, 0) == FALSE);
+    fail_unless(result == NULL);
+}
+END_TEST
+
+
+START_TEST(packed_results)
+{
+    prolog_predicate_t *pred;
+    void               *args[] = { (void *)'i', (void *)3141 };
+    int                 narg = 1;
+    double              buf[64];
+    size_t              size;
+
+    pred = find_predicate(predicates, "predicates", "echo", 2);
+    fail_unless(pred != NULL, "Failed to find predicates:echo/2.");
+
+    size = 8;
+    fail_unless(prolog_acall_packed(pred, buf, &size, args, narg) == -ENOSPC);
+    fail_unless(size > 8 && size <= sizeof(buf));
+
+    size = sizeof(buf);
+    fail_unless(prolog_acall_packed(pred, buf, &size, args, narg) > 0);
+    fail_unless(prolog_packed_check(buf, size) == 0);
+    fail_unless(prolog_packed_count(buf) == 1);
+    fail_unless(!strcmp(prolog_packed_string(buf, 0, 0), "echoed"));
+    fail_unless(prolog_packed_lookup(buf, 0, "value") == 1);
+    fail_unless(prolog_packed_type(buf, 0, 1) == 'i' &&
+                prolog_packed_integer(buf, 0, 1) == 3141);
+
+    prolog_dump_packed(buf);
+}
+END_TEST
+
+
+START_TEST(packed_exception)
+{
+    prolog_predicate_t *pred;
+    double              buf[64];
+    size_t              size;
+
+    pred = find_predicate(predicates, "predicates", "exception", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:exception/1.");
+
+    size = sizeof(buf);
+    fail_unless(prolog_acall_packed(pred, buf, &size, NULL, 0) == -ECANCELED);
+    fail_unless(prolog_packed_check(buf, size) == 0);
+    fail_unless(prolog_packed_exception(buf) != NULL);
+
+    prolog_dump_packed(buf);
+}
+END_TEST
+
+
+START_TEST(delta_results)
+{
+    prolog_predicate_t *pred;
+    void               *args[] = { (void *)'s', (void *)"foo" };
+    int                 narg = 1;
+    prolog_delta_t      delta;
+
+    pred = find_predicate(predicates, "predicates", "echo", 2);
+    fail_unless(pred != NULL, "Failed to find predicates:echo/2.");
+
+    fail_unless(prolog_acall_delta(pred, &delta, args, narg) > 0);
+    fail_unless(delta.added != NULL && delta.added[0] != NULL);
+    fail_unless(delta.removed == NULL && delta.changed == NULL);
+    prolog_dump_delta(&delta);
+    prolog_free_delta(&delta);
+
+    fail_unless(prolog_acall_delta(pred, &delta, args, narg) > 0);
+    fail_unless(delta.added == NULL && delta.removed == NULL &&
+                delta.changed == NULL && delta.previous == NULL);
+    prolog_free_delta(&delta);
+
+    pred = find_predicate(predicates, "predicates", "counter", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:counter/1.");
+
+    fail_unless(prolog_acall_delta(pred, &delta, NULL, 0) > 0);
+    fail_unless(delta.added != NULL);
+    prolog_free_delta(&delta);
+
+    fail_unless(prolog_acall_delta(pred, &delta, NULL, 0) > 0);
+    fail_unless(delta.added == NULL && delta.removed == NULL);
+    fail_unless(delta.changed != NULL && delta.previous != NULL);
+    fail_unless((int)delta.changed[0][4] == 'i' &&
+                (int)delta.previous[0][4] == 'i' &&
+                (int)delta.changed[0][5] == (int)delta.previous[0][5] + 1);
+    prolog_dump_delta(&delta);
+    prolog_free_delta(&delta);
+
+    prolog_forget_results(pred);
+    fail_unless(prolog_acall_delta(pred, &delta, NULL, 0) > 0);
+    fail_unless(delta.added != NULL && delta.changed == NULL);
+    prolog_free_delta(&delta);
+}
+END_TEST
+
+
+START_TEST(delta_fields)
+{
+    prolog_predicate_t *pred;
+    prolog_delta_t      delta;
+
+    pred = find_predicate(predicates, "predicates", "reshape", 1);
+    fail_unless(pred != NULL, "Failed to find predicates:reshape/1.");
+
+    fail_unless(prolog_acall_delta(pred, &delta, NULL, 0) > 0);
+    fail_unless(delta.added != NULL);
+    prolog_free_delta(&delta);
+
+    /* a field added: only it is changed, nothing is previous */
+    fail_unless(prolog_acall_delta(pred, &delta, NULL, 0) > 0);
+    fail_unless(delta.added == NULL && delta.removed == NULL);
+    fail_unless(delta.changed != NULL && delta.previous != NULL);
+    fail_unless(!strcmp(delta.changed[0][2], "reshape") &&
+                !strcmp(delta.changed[0][3], "extra") &&
+                delta.changed[0][6] == NULL);
+    fail_unless(!strcmp(delta.previous[0][2], "reshape") &&
+                delta.previous[0][3] == NULL);
+    prolog_dump_delta(&delta);
+    prolog_free_delta(&delta);
+
+    /* a field removed: nothing is changed, only it is previous */
+    fail_unless(prolog_acall_delta(pred, &delta, NULL, 0) > 0);
+    fail_unless(delta.added == NULL && delta.removed == NULL);
+    fail_unless(delta.changed != NULL && delta.previous != NULL);
+    fail_unless(!strcmp(delta.changed[0][2], "reshape") &&
+                delta.changed[0][3] == NULL);
+    fail_unless(!strcmp(delta.previous[0][2], "reshape") &&
+                !strcmp(delta.previous[0][3], "extra") &&
+                delta.previous[0][6] == NULL);
+    prolog_dump_delta(&delta);
+    prolog_free_delta(&delta);
+}
+END_TEST
+
+
 
 
 void
@@ -239,6 +460,31 @@ chkprolog_pred_tests(Suite *suite)
     tcase_add_test(tc, string_argument);
 
     suite_add_tcase(suite, tc);
+
+    tc = tcase_create("arena");
+    tcase_add_checked_fixture(tc, setup_arena, teardown_arena);
+
+    tcase_add_test(tc, arena_results);
+    tcase_add_test(tc, arena_large_results);
+    tcase_add_test(tc, arena_exception);
+
+    suite_add_tcase(suite, tc);
+
+    tc = tcase_create("packed");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, packed_results);
+    tcase_add_test(tc, packed_exception);
+
+    suite_add_tcase(suite, tc);
+
+    tc = tcase_create("delta");
+    tcase_add_checked_fixture(tc, setup, teardown);
+
+    tcase_add_test(tc, delta_results);
+    tcase_add_test(tc, delta_fields);
+
+    suite_add_tcase(suite, tc);
 }
 
 
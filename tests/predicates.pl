@@ -21,9 +21,11 @@
 
 
 
-:- module(predicates, [success/1, failure/1, exception/1, echo/2]).
+:- module(predicates, [success/1, failure/1, exception/1, echo/2,
+                       counter/1, reshape/1, many/1]).
 
-rules([success/1, failure/1, exception/1, echo/2, undefined/1]).
+rules([success/1, failure/1, exception/1, echo/2, counter/1, reshape/1,
+       many/1, undefined/1]).
 
 % always succeed
 success([[success, [always, succeeds]]]).
@@ -39,3 +41,20 @@ echo(A, List) :-
         writef('echo got %w', [A]),
 	List = [[echoed, [value, A]]].
 
+% return an increasing counter on every call
+counter([[counter, [value, N]]]) :-
+        (nb_current(counter, C) -> N is C + 1 ; N = 1),
+        nb_setval(counter, N).
+
+% gain a field on the second call and lose it again on the third
+reshape([Object]) :-
+        (nb_current(reshape, C) -> N is C + 1 ; N = 1),
+        nb_setval(reshape, N),
+        (N =:= 2 ->
+            Object = [reshape, [kept, 1], [extra, 2]]
+        ;
+            Object = [reshape, [kept, 1]]).
+
+% return more objects than fit a single arena chunk
+many(List) :-
+        findall([many, [index, I]], between(1, 200, I), List).